@@ -0,0 +1,162 @@
+/*
+
+    Static ROM analyzer (no SDL).
+
+    Analyzes every ROM (files, or every file of a directory) with rommap_analyze()
+    on ANALYZE_THREADS worker threads, writes <rom name>.map in the current directory
+    (see rommap.h for the format) and prints a summary per ROM:
+        code / data / unknown   : share of the ROM bytes
+        blocks                  : basic blocks
+        funcs                   : distinct subroutines (2nnn targets)
+        computed                : Bnnn computed jumps
+        smc                     : writes which land on code
+
+    usage: chip8-analyze <rom or directory> [...]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "rommap.h"
+
+using namespace std;
+
+#define ANALYZE_THREADS     4           /* worker threads (at most one per ROM) */
+
+struct STRUCT_JOB
+{
+    string      path;
+    string      name;           /* file name without the directory  */
+    ROM_MAP     *map;
+    int         result;         /* 0, or -1 if it could not be analyzed / written */
+};
+
+void add_path(vector<STRUCT_JOB>&, const string&);
+void analyze_worker(vector<STRUCT_JOB>*, atomic<size_t>*);
+void print_summary(const STRUCT_JOB&);
+
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        cout<<"usage: chip8-analyze <rom or directory> [...]"<<endl;
+        return 1;
+    }
+
+    vector<STRUCT_JOB> jobs;
+    for(int i = 1; i < argc; i++) {
+        add_path(jobs, argv[i]);
+    }
+    if(jobs.empty()) {
+        cerr<<"no ROM files found."<<endl;
+        return 1;
+    }
+    sort(jobs.begin(), jobs.end(), [](const STRUCT_JOB& a, const STRUCT_JOB& b) { return a.name < b.name; });
+
+    auto start = chrono::steady_clock::now();
+
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    size_t n_threads = min((size_t) ANALYZE_THREADS, jobs.size());
+    for(size_t t = 0; t < n_threads; t++) {
+        workers.push_back(thread(analyze_worker, &jobs, &next));
+    }
+    for(size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout<<left<<setw(20)<<"ROM"<<right<<setw(7)<<"size"<<setw(8)<<"code"<<setw(8)<<"data"<<setw(9)<<"unknown"
+        <<setw(8)<<"blocks"<<setw(7)<<"funcs"<<setw(10)<<"computed"<<setw(5)<<"smc"<<endl;
+    int failed = 0;
+    for(size_t j = 0; j < jobs.size(); j++) {
+        if(jobs[j].result == -1) {
+            cerr<<"could not analyze "<<jobs[j].path<<", skipped."<<endl;
+            failed++;
+        } else {
+            print_summary(jobs[j]);
+        }
+        delete jobs[j].map;
+    }
+    cout<<jobs.size() - failed<<" ROMs analyzed in "<<fixed<<setprecision(2)<<seconds * 1000<<" ms ("<<n_threads<<" threads)"<<endl;
+
+    return failed ? 1 : 0;
+}
+
+/* adds PATH, or every regular file in it if it is a directory */
+void add_path(vector<STRUCT_JOB>& jobs, const string& path) {
+    struct stat st;
+    if(stat(path.c_str(), &st) == -1) {
+        cerr<<"could not open "<<path<<", skipped."<<endl;
+        return;
+    }
+
+    vector<string> files;
+    if(S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path.c_str());
+        if(dir == NULL) {
+            cerr<<"could not open "<<path<<", skipped."<<endl;
+            return;
+        }
+        struct dirent *entry;
+        while((entry = readdir(dir)) != NULL) {
+            string file = path + "/" + entry->d_name;
+            if(entry->d_name[0] != '.' && stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                files.push_back(file);
+            }
+        }
+        closedir(dir);
+    } else {
+        files.push_back(path);
+    }
+
+    for(size_t f = 0; f < files.size(); f++) {
+        STRUCT_JOB job;
+        size_t     slash = files[f].find_last_of('/');
+        job.path   = files[f];
+        job.name   = slash == string::npos ? files[f] : files[f].substr(slash + 1);
+        job.map    = new ROM_MAP();
+        job.result = -1;
+        jobs.push_back(job);
+    }
+}
+
+/* analyzes and exports jobs until there are none left */
+void analyze_worker(vector<STRUCT_JOB> *jobs, atomic<size_t> *next) {
+    size_t j;
+    while((j = next->fetch_add(1)) < jobs->size()) {
+        STRUCT_JOB& job = (*jobs)[j];
+        if(rommap_analyze_file(job.path.c_str(), job.map) == 0 &&
+           rommap_write(job.map, (job.name + ".map").c_str(), job.name.c_str()) == 0) {
+            job.result = 0;
+        }
+    }
+}
+
+void print_summary(const STRUCT_JOB& job) {
+    const ROM_MAP *map = job.map;
+    int count[3] = {0, 0, 0};
+    int computed = 0;
+    for(int a = PC_STARTADR; a < PC_STARTADR + map->size; a++) {
+        count[map->kind[a]]++;
+        computed += (map->flags[a] & MAP_COMPUTED) ? 1 : 0;
+    }
+    set<uint16_t> funcs;
+    for(size_t c = 0; c < map->calls.size(); c++) {
+        funcs.insert(map->calls[c].second);
+    }
+
+    double size = map->size ? map->size : 1;
+    cout<<left<<setw(20)<<job.name<<right<<setw(7)<<map->size<<fixed<<setprecision(1)
+        <<setw(7)<<100.0 * count[MAP_CODE] / size<<"%"
+        <<setw(7)<<100.0 * count[MAP_DATA] / size<<"%"
+        <<setw(8)<<100.0 * count[MAP_UNKNOWN] / size<<"%"
+        <<setw(8)<<map->blocks.size()<<setw(7)<<funcs.size()<<setw(10)<<computed<<setw(5)<<map->smc.size()<<endl;
+}
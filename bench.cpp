@@ -0,0 +1,380 @@
+/*
+
+    Headless interpreter benchmark (no SDL).
+
+    1. Profile: runs every ROM cycle() by cycle() with the timing model, a scripted
+       key sequence, and counts the hottest opcode pairs and how many instructions
+       each idle loop (FUSE_*) would have covered. The ones covering at least
+       BENCH_MINSHARE of the instructions are picked.
+
+    2. Throughput: runs every ROM for BENCH_FRAMES frames with run_frame(): with plain
+       dispatch and with the picked idle loops skipped, and checks both end in the same
+       machine state. A skipped idle loop retires its instructions without running them,
+       so they are counted as executed.
+
+    Golden run (-g / -G): runs every ROM for GOLDEN_FRAMES frames with the scripted keys, plain
+    and with the idle loops skipped, and checks the frame_hash() every GOLDEN_PERIOD frames against a golden file
+    (-G writes it), and that the hash kept by the interpreter is the one of the frame rebuilt
+    from scratch. Exits with 1 on any difference.
+
+    usage: chip8-bench <rom> [<rom> ...]
+           chip8-bench -g|-G <golden file> <rom> [<rom> ...]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include "chip8.h"
+
+using namespace std;
+
+#define BENCH_FRAMES        20000       /* frames run per ROM and mode                      */
+#define BENCH_PROFILEFRAMES 3000        /* frames profiled per ROM                          */
+#define BENCH_MINSHARE      0.005       /* share of instructions an idle loop needs to be skipped */
+#define BENCH_TOPPAIRS      8           /* opcode pairs listed                              */
+#define BENCH_KEYPERIOD     30          /* frames between scripted key changes              */
+#define GOLDEN_FRAMES       1200        /* frames run per ROM by the golden run             */
+#define GOLDEN_PERIOD       120         /* frames between two checked frame hashes         */
+
+void        press_keys(CHIP8*, int);
+uint16_t    fetch(CHIP8*, uint16_t);
+string      shape(uint16_t);
+uint8_t     profile(vector<CHIP8*>&);
+double      run_frames(CHIP8*, int);
+bool        same_state(CHIP8*, CHIP8*);
+int         golden(vector<CHIP8*>&, vector<char*>&, char*, bool);
+string      rom_name(char*);
+void        print_usage();
+
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        print_usage();
+        return 1;
+    }
+
+    char *golden_path  = NULL;
+    bool  golden_write = false;
+    int   first        = 1;
+    if(strcmp(argv[1], "-g") == 0 || strcmp(argv[1], "-G") == 0) {
+        if(argc < 4) {
+            print_usage();
+            return 1;
+        }
+        golden_path  = argv[2];
+        golden_write = argv[1][1] == 'G';
+        first        = 3;
+    }
+
+    vector<CHIP8*> roms;
+    vector<char*>  names;
+    for(int i = first; i < argc; i++) {
+        CHIP8 *c = new CHIP8();
+        if(c->swap_rom(argv[i]) == -1) {
+            cerr<<"could not open ROM file "<<argv[i]<<", skipped."<<endl;
+            delete c;
+            continue;
+        }
+        c->set_seed(1);
+        c->set_timing(true);
+        roms.push_back(c);
+        names.push_back(argv[i]);
+    }
+    if(roms.empty()) {
+        return 1;
+    }
+
+    if(golden_path != NULL) {
+        int status = golden(roms, names, golden_path, golden_write);
+        for(size_t r = 0; r < roms.size(); r++) {
+            delete roms[r];
+        }
+        return status;
+    }
+
+    uint8_t mask = profile(roms);
+
+    /* idle: the picked idle loops skipped, against plain dispatch */
+    cout<<endl<<"THROUGHPUT ("<<BENCH_FRAMES<<" frames per ROM, million instructions/s):"<<endl;
+    cout<<left<<setw(24)<<"ROM"<<right<<setw(10)<<"plain"<<setw(12)<<"idle skip"<<setw(10)<<"speedup"
+        <<setw(8)<<"state"<<endl;
+
+    double plain_total = 0, idle_total = 0;
+    uint64_t instrs_total = 0;
+    bool   all_same = true;
+    for(size_t r = 0; r < roms.size(); r++) {
+        CHIP8 plain(*roms[r]);
+        CHIP8 idle(*roms[r]);
+        idle.set_fusion(mask);
+
+        double t_plain = run_frames(&plain, BENCH_FRAMES);
+        double t_idle  = run_frames(&idle, BENCH_FRAMES);
+        bool   same    = same_state(&plain, &idle);
+        all_same       = all_same && same;
+
+        plain_total  += t_plain;
+        idle_total   += t_idle;
+        instrs_total += plain.get_instrs();
+
+        string name = rom_name(names[r]);
+        cout<<left<<setw(24)<<name<<right<<fixed<<setprecision(1)
+            <<setw(10)<<plain.get_instrs() / t_plain / 1e6
+            <<setw(12)<<idle.get_instrs() / t_idle / 1e6
+            <<setw(9)<<setprecision(2)<<t_plain / t_idle<<"x"
+            <<setw(8)<<(same ? "same" : "DIFF")<<endl;
+        if(plain.get_fault()) {
+            cout<<"    "<<CHIP8::fault_name(plain.get_fault())<<" fault at PC 0x"<<hex<<plain.get_fault_pc()<<dec<<endl;
+        }
+    }
+    cout<<left<<setw(24)<<"TOTAL"<<right<<fixed<<setprecision(1)
+        <<setw(10)<<instrs_total / plain_total / 1e6
+        <<setw(12)<<instrs_total / idle_total / 1e6
+        <<setw(9)<<setprecision(2)<<plain_total / idle_total<<"x"<<endl;
+
+    for(size_t r = 0; r < roms.size(); r++) {
+        delete roms[r];
+    }
+    return all_same ? 0 : 1;
+}
+
+/* scripted input: one key held for BENCH_KEYPERIOD frames, then none for as long */
+void press_keys(CHIP8 *c, int frame) {
+    int step = frame / BENCH_KEYPERIOD;
+    for(int k = 0; k < MAX_KEYCOUNT; k++) {
+        c->set_key(k, (step % 2 == 1 && k == (step / 2) % MAX_KEYCOUNT) ? KEY_DOWN : KEY_UP);
+    }
+}
+
+uint16_t fetch(CHIP8 *c, uint16_t addr) {
+    return (c->read_mem(addr) << 8) | c->read_mem(addr + 1);
+}
+
+/* opcode with its operands masked out, e.g. "Dxyn", "Fx07" */
+string shape(uint16_t op) {
+    const char *hex = "0123456789ABCDEF";
+    string s = "";
+    s += hex[op >> 12];
+    switch(op >> 12) {
+        case 0x0: return op == 0x00E0 ? "00E0" : op == 0x00EE ? "00EE" : "0nnn";
+        case 0x1: case 0x2: case 0xA: case 0xB: return s + "nnn";
+        case 0x3: case 0x4: case 0x6: case 0x7: case 0xC: return s + "xkk";
+        case 0x5: case 0x9: case 0xD: return s + "xyn";
+        case 0x8: return s + "xy" + hex[op & 0xF];
+    }
+    return s + "x" + hex[(op >> 4) & 0xF] + hex[op & 0xF];
+}
+
+/*
+    Profiles a copy of every ROM, prints the hottest opcode pairs and the idle loops,
+    and returns the FUSE_* mask of the ones worth skipping.
+*/
+uint8_t profile(vector<CHIP8*>& roms) {
+    map<string, uint64_t> pairs;
+    uint64_t hits[3]  = {0, 0, 0};
+    uint64_t total    = 0;
+
+    for(size_t r = 0; r < roms.size(); r++) {
+        CHIP8 c(*roms[r]);
+        string last = "";
+        for(int f = 0; f < BENCH_PROFILEFRAMES; f++) {
+            press_keys(&c, f);
+            uint64_t frame_end = c.get_cycles() - c.get_cycles() % VIP_CYCLES_PER_FRAME + VIP_CYCLES_PER_FRAME;
+            while(c.get_cycles() < frame_end) {
+                uint16_t pc  = c.get_PC();
+                uint16_t op0 = fetch(&c, pc);
+                uint16_t op1 = fetch(&c, pc + 2);
+                uint16_t op2 = fetch(&c, pc + 4);
+                string   s   = shape(op0);
+                if(last != "") {
+                    pairs[last + ";" + s]++;
+                }
+                last = s;
+
+                bool key_down = false;
+                for(int k = 0; k < MAX_KEYCOUNT; k++) {
+                    key_down = key_down || c.get_key(k) == KEY_DOWN;
+                }
+                if(op0 == (0x1000 | pc)) {
+                    hits[1] += 1;
+                } else if((op0 & 0xF0FF) == 0xF00A && !key_down) {
+                    hits[2] += 1;
+                } else if((op0 & 0xF0FF) == 0xF007 && op1 == (0x3000 | (op0 & 0x0F00)) && (op2 >> 12) == 0x1) {
+                    hits[0] += 3;
+                }
+                total++;
+                if(c.cycle() != 0) {
+                    break;
+                }
+            }
+        }
+    }
+
+    vector<pair<uint64_t, string> > sorted;
+    for(map<string, uint64_t>::iterator it = pairs.begin(); it != pairs.end(); ++it) {
+        sorted.push_back(make_pair(it->second, it->first));
+    }
+    sort(sorted.rbegin(), sorted.rend());
+
+    cout<<"PROFILE ("<<roms.size()<<" ROMs, "<<total<<" instructions):"<<endl;
+    cout<<"hottest opcode pairs:"<<endl;
+    for(size_t i = 0; i < sorted.size() && i < BENCH_TOPPAIRS; i++) {
+        cout<<"\t"<<sorted[i].second<<"\t"<<fixed<<setprecision(2)<<100.0 * sorted[i].first / total<<"%"<<endl;
+    }
+
+    const char *names[3] = {"Fx07;3x00;1nnn", "1nnn (self)", "Fx0A (no key)"};
+    uint8_t     kinds[3] = {FUSE_WAIT, FUSE_SPIN, FUSE_KEY};
+    uint8_t     mask     = 0;
+    cout<<"idle loops (instructions covered, skipped up to the frame end):"<<endl;
+    for(int k = 0; k < 3; k++) {
+        double share = total ? (double) hits[k] / total : 0;
+        bool   pick  = share >= BENCH_MINSHARE;
+        if(pick) {
+            mask |= kinds[k];
+        }
+        cout<<"\t"<<left<<setw(16)<<names[k]<<right<<fixed<<setprecision(2)<<100.0 * share<<"%"
+            <<(pick ? "\tskipped" : "\trun")<<endl;
+    }
+    return mask;
+}
+
+/* runs FRAMES frames with the scripted input, returns the seconds it took */
+double run_frames(CHIP8 *c, int frames) {
+    auto start = chrono::steady_clock::now();
+    for(int f = 0; f < frames; f++) {
+        press_keys(c, f);
+        if(c->run_frame() != 0) {
+            break;
+        }
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/* compares everything a program can observe */
+bool same_state(CHIP8 *a, CHIP8 *b) {
+    if(a->get_PC() != b->get_PC() || a->get_I() != b->get_I() || a->get_SP() != b->get_SP() ||
+       a->get_DT() != b->get_DT() || a->get_ST() != b->get_ST() ||
+       a->get_cycles() != b->get_cycles() || a->get_instrs() != b->get_instrs()) {
+        return false;
+    }
+    for(int i = 0; i < MAX_REGCOUNT; i++) {
+        if(a->get_V(i) != b->get_V(i)) {
+            return false;
+        }
+    }
+    for(int i = 0; i < MAX_STACKSIZE; i++) {
+        if(a->get_stack(i) != b->get_stack(i)) {
+            return false;
+        }
+    }
+    for(int y = 0; y < MAX_HEIGHT; y++) {
+        if(a->get_row(y) != b->get_row(y)) {
+            return false;
+        }
+    }
+    for(int addr = 0; addr < MAX_MEMSIZE; addr++) {
+        if(a->read_mem(addr) != b->read_mem(addr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    The golden run: GOLDEN_FRAMES frames of every ROM, plain and with the idle loops skipped, with the scripted keys.
+    Writes the frame hashes to PATH (WRITE), or checks them against it.
+    Returns 0 if every hash matched, 1 otherwise.
+*/
+int golden(vector<CHIP8*>& roms, vector<char*>& names, char *path, bool write) {
+    map<string, uint64_t> expected;
+    if(!write) {
+        ifstream in(path);
+        if(!in) {
+            cerr<<"could not open golden file "<<path<<"."<<endl;
+            return 1;
+        }
+        string line;
+        while(getline(in, line)) {
+            if(line.empty() || line[0] == '#') {
+                continue;
+            }
+            istringstream fields(line);
+            string   name;
+            int      frame;
+            uint64_t hash;
+            fields>>name>>frame>>hex>>hash;
+            expected[name + " " + to_string(frame)] = hash;
+        }
+    }
+
+    ofstream out;
+    if(write) {
+        out.open(path);
+        out<<"# chip8-bench golden frame hashes: rom, frame, frame_hash()"<<endl;
+    }
+
+    int failed = 0;
+    for(size_t r = 0; r < roms.size(); r++) {
+        string name   = rom_name(names[r]);
+        string status = "ok";
+        CHIP8  plain(*roms[r]);
+        CHIP8  idle(*roms[r]);
+        idle.set_fusion(FUSE_IDLE);
+
+        for(int frame = 0; frame < GOLDEN_FRAMES && status == "ok"; frame++) {
+            press_keys(&plain, frame);
+            press_keys(&idle, frame);
+            if(plain.run_frame() == -1 || idle.run_frame() == -1) {
+                status = "error at frame " + to_string(frame);
+                break;
+            }
+            if((frame + 1) % GOLDEN_PERIOD != 0) {
+                continue;
+            }
+
+            /* the hash kept up to date by Dxyn / 00E0 against the one of the same frame loaded from scratch */
+            MACHINE_STATE state;
+            CHIP8 rebuilt(plain);
+            plain.save_state(&state);
+            rebuilt.load_state(&state);
+
+            uint64_t    hash = plain.frame_hash();
+            string      key  = name + " " + to_string(frame + 1);
+            if(hash != rebuilt.frame_hash()) {
+                status = "hash out of date at frame " + to_string(frame + 1);
+            } else if(idle.frame_hash() != hash) {
+                status = "idle skip differs at frame " + to_string(frame + 1);
+            } else if(write) {
+                out<<name<<" "<<frame + 1<<" 0x"<<hex<<hash<<dec<<endl;
+            } else if(expected.count(key) == 0) {
+                status = "no golden hash for frame " + to_string(frame + 1);
+            } else if(expected[key] != hash) {
+                status = "DIFF at frame " + to_string(frame + 1);
+            }
+        }
+        failed += status != "ok";
+        cout<<left<<setw(24)<<name<<status;
+        if(plain.get_fault()) {
+            cout<<" ("<<CHIP8::fault_name(plain.get_fault())<<" fault at PC 0x"<<hex<<plain.get_fault_pc()<<dec<<")";
+        }
+        cout<<endl;
+    }
+
+    cout<<roms.size() - failed<<" of "<<roms.size()<<" ROMs "<<(write ? "written to " : "match ")<<path<<"."<<endl;
+    return failed == 0 ? 0 : 1;
+}
+
+/* file name of a ROM path */
+string rom_name(char *path) {
+    string name = path;
+    return name.substr(name.find_last_of('/') + 1);
+}
+
+void print_usage() {
+    cout<<"usage: chip8-bench <rom> [<rom> ...]"<<endl;
+    cout<<"       chip8-bench -g|-G <golden file> <rom> [<rom> ...] : checks / writes the golden frame hashes"<<endl;
+}
@@ -9,11 +9,120 @@
 */
 
 #include "chip8.h"
+#include "metrics.h"
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <random>
+#include <algorithm>
+#include <vector>
+
+/*
+
+    Memory pages and ROM images.
+    A page is freed by whoever drops the last reference.
+
+*/
+static MEM_PAGE* page_acquire(MEM_PAGE *page) {
+    page->refs.fetch_add(1, std::memory_order_relaxed);
+    return page;
+}
+
+static void page_release(MEM_PAGE *page) {
+    if(page != NULL && page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete page;
+    }
+}
+
+static ROM_IMAGE* image_acquire(ROM_IMAGE *image) {
+    image->refs.fetch_add(1, std::memory_order_relaxed);
+    return image;
+}
+
+static void image_release(ROM_IMAGE *image) {
+    if(image != NULL && image->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        for(int p = 0; p < image->count; p++) {
+            page_release(image->pages[p]);
+        }
+        delete image;
+    }
+}
+
+/* font set, loaded in memory from 0x00 */
+static const uint8_t FONT_SET[MAX_FONTCOUNT] {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+/* SUPER-CHIP / XO-CHIP 8 x 10 font set, loaded in memory from BIGFONT_ADR */
+static const uint8_t BIGFONT_SET[MAX_BIGFONTCOUNT] {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+/*
+    Builds the power-on memory of VARIANT for ROM (SIZE bytes, may be NULL): font at 0x00
+    (and the 8 x 10 font at BIGFONT_ADR but for CHIP-8), ROM at PC_STARTADR.
+    The image is returned holding one reference.
+*/
+static ROM_IMAGE* image_create(const uint8_t *rom, int size, int variant) {
+    int count = variant == VARIANT_XOCHIP ? MEM_MAXPAGES : MEM_PAGECOUNT;
+    std::vector<uint8_t> mem(count * MEM_PAGESIZE, 0x0);
+    memcpy(&mem[0], FONT_SET, MAX_FONTCOUNT);
+    if(variant != VARIANT_CHIP8) {
+        memcpy(&mem[BIGFONT_ADR], BIGFONT_SET, MAX_BIGFONTCOUNT);
+    }
+    if(rom != NULL) {
+        memcpy(&mem[PC_STARTADR], rom, size);
+    }
+
+    ROM_IMAGE *image = new ROM_IMAGE;
+    image->refs.store(1, std::memory_order_relaxed);
+    image->count = count;
+    for(int p = 0; p < count; p++) {
+        image->pages[p] = new MEM_PAGE;
+        image->pages[p]->refs.store(1, std::memory_order_relaxed);
+        memcpy(image->pages[p]->data, &mem[p * MEM_PAGESIZE], MEM_PAGESIZE);
+    }
+    return image;
+}
+
+/*
+    The font-only image of instances without a ROM, shared by all of them.
+*/
+static ROM_IMAGE* blank_image() {
+    static ROM_IMAGE *image = image_create(NULL, 0, VARIANT_CHIP8);
+    return image;
+}
 
 /*
 
@@ -22,7 +131,57 @@
 */
 CHIP8::CHIP8() {
 
-    std::cout<< "Initializing CHIP8 instance..."<<std::endl;
+    /*
+
+        Profiling and Debug Data
+
+    */
+    OP_CYCLES  = NULL;
+    COV        = NULL;
+    COV_PREV   = 0;
+    FUSE       = NULL;
+    FUSE_MASK  = 0;
+    DBG_MAP    = NULL;
+    DBG_ARMED  = 0;
+    DBG_REASON = -1;
+    DBG_ADDR   = 0x0;
+    DBG_SKIP   = false;
+
+    MODE_SND  = false;
+    MODE_STP  = false;
+    MODE_VRB  = false;
+    MODE_TIM  = false;
+    MTR       = NULL;
+
+    /* CHIP-8 until set_variant says otherwise */
+    VARIANT   = VARIANT_CHIP8;
+    XDISP     = NULL;
+    MEM_MASK  = MAX_MEMSIZE - 1;
+    memset(FLAGS, 0x0, sizeof(FLAGS));
+
+    /* no ROM yet: font only */
+    IMAGE     = image_acquire(blank_image());
+    PAGE      = NULL;
+    page_table(IMAGE->count);
+    PAGES     = IMAGE->count;
+
+    reset();
+
+    /*
+        Seed the RNG
+    */
+    set_seed(time(NULL));
+
+}
+
+/*
+
+    Puts the machine back to its power-on state (fonts, MEM, registers, timers, display, keys):
+    MEM points back at the (shared) pages of the loaded ROM's image.
+    Modes and armed breakpoints/watchpoints are kept.
+
+*/
+void CHIP8::reset() {
     /*
         
         CPU Data
@@ -32,195 +191,1722 @@ CHIP8::CHIP8() {
     
     PC   = PC_STARTADR;
     I    = 0x0;
-    DT   = 0x0;
-    ST   = 0x0;
+
+    /*
+
+        Timing Data
+
+    */
+    CYCLES    = 0;
+    INSTRS    = 0;
+    NEXT_TICK = VIP_CYCLES_PER_FRAME;
+    DT_END    = 0;
+    ST_END    = 0;
+    if(OP_CYCLES != NULL) {
+        memset(OP_CYCLES, 0x0, 16 * sizeof(uint64_t));
+    }
     
     /*
         
         MEM Data
         
     */
-    memset(MEM  , 0x0, sizeof( MEM ));
+    for(int p = 0; p < PAGES; p++) {
+        page_release(PAGE[p]);
+        PAGE[p] = page_acquire(IMAGE->pages[p]);
+    }
     memset(STACK, 0x0, sizeof(STACK));
+    if(FUSE != NULL) {
+        memset(FUSE, 0x0, MAX_MEMSIZE);
+    }
    
     SP   = -1;
+    FAULT    = 0;
+    FAULT_PC = 0;
 
     /*
         
         I/O Data
         
     */
-    memset(DISP, PIX_OFF, sizeof(DISP));
+    memset(DISP, 0x0, sizeof(DISP));
     memset(KEYP, KEY_UP, sizeof(KEYP));
 
-    draw_flag = false;
-    MODE_SND  = false;
-    MODE_STP  = false;
-    MODE_VRB  = false;
+    /* SUPER-CHIP / XO-CHIP: low resolution, drawing to plane 1, silent (the flags survive) */
+    if(XDISP != NULL) {
+        memset(XDISP, 0x0, plane_count() * HIRES_HEIGHT * HIRES_WORDS * sizeof(uint64_t));
+    }
+    DISP_HASH = 0;
+    HIRES  = false;
+    PLANES = 0x1;
+    PITCH  = 64;
+    memset(AUDIO, 0x0, sizeof(AUDIO));
+
+    INQ_HEAD   = 0;
+    INQ_TAIL   = 0;
+    INPUT_NS   = 0;
+
+    draw_flag  = true;
+    DBG_REASON = -1;
+}
+
+/*
+
+    CHIP8 Destructor
+
+*/
+CHIP8::~CHIP8() {
+    release_memory();
+    if(PAGE != PAGE_TABLE) {
+        delete[] PAGE;
+    }
+    delete[] OP_CYCLES;
+    delete[] FUSE;
+    delete[] DBG_MAP;
+    delete[] XDISP;
+}
+
+/*
+
+    Copies: the machine state is copied and every memory page shared,
+    the debugger, profiling and metrics attachments are not.
+
+*/
+CHIP8::CHIP8(const CHIP8& other) {
+    OP_CYCLES  = NULL;
+    COV        = NULL;
+    COV_PREV   = 0;
+    FUSE       = NULL;
+    FUSE_MASK  = 0;
+    DBG_MAP    = NULL;
+    DBG_ARMED  = 0;
+    DBG_REASON = -1;
+    DBG_ADDR   = 0x0;
+    DBG_SKIP   = false;
+    MTR        = NULL;
+    IMAGE      = NULL;
+    PAGES      = 0;
+    PAGE       = NULL;
+    XDISP      = NULL;
+    copy_machine(other);
+}
+
+CHIP8& CHIP8::operator=(const CHIP8& other) {
+    if(this != &other) {
+        copy_machine(other);
+    }
+    return *this;
+}
+
+/*
+    Copies the machine state of OTHER, sharing its pages.
+*/
+void CHIP8::copy_machine(const CHIP8& other) {
+    /* the idle loops are found in the ROM image, and checked against the pages on use */
+    if(FUSE != NULL && IMAGE != other.IMAGE) {
+        memset(FUSE, 0x0, MAX_MEMSIZE);
+    }
+    release_memory();
+
+    memcpy(V, other.V, sizeof(V));
+    PC        = other.PC;
+    I         = other.I;
+    SP        = other.SP;
+    draw_flag = other.draw_flag;
+
+    CYCLES    = other.CYCLES;
+    INSTRS    = other.INSTRS;
+    NEXT_TICK = other.NEXT_TICK;
+    DT_END    = other.DT_END;
+    ST_END    = other.ST_END;
+    MODE_TIM  = other.MODE_TIM;
+    MODE_VRB  = other.MODE_VRB;
+    MODE_SND  = other.MODE_SND;
+    MODE_STP  = other.MODE_STP;
+    RNG       = other.RNG;
+
+    /* every page is held twice from here, so both sides copy before their next write to it */
+    page_table(other.PAGES);
+    PAGES    = other.PAGES;
+    MEM_MASK = other.MEM_MASK;
+    FAULT    = other.FAULT;
+    FAULT_PC = other.FAULT_PC;
+    for(int p = 0; p < PAGES; p++) {
+        PAGE[p] = page_acquire(other.PAGE[p]);
+    }
+    IMAGE  = image_acquire(other.IMAGE);
+    memcpy(STACK, other.STACK, sizeof(STACK));
+
+    /* the display of the variant, reallocated if it is another one */
+    if(XDISP == NULL || VARIANT != other.VARIANT) {
+        delete[] XDISP;
+        VARIANT = other.VARIANT;
+        XDISP   = other.XDISP != NULL ? new uint64_t[plane_count() * HIRES_HEIGHT * HIRES_WORDS] : NULL;
+    }
+    if(XDISP != NULL) {
+        memcpy(XDISP, other.XDISP, plane_count() * HIRES_HEIGHT * HIRES_WORDS * sizeof(uint64_t));
+    }
+    HIRES  = other.HIRES;
+    PLANES = other.PLANES;
+    PITCH  = other.PITCH;
+    memcpy(FLAGS, other.FLAGS, sizeof(FLAGS));
+    memcpy(AUDIO, other.AUDIO, sizeof(AUDIO));
+
+    memcpy(DISP, other.DISP, sizeof(DISP));
+    DISP_HASH = other.DISP_HASH;
+    memcpy(KEYP, other.KEYP, sizeof(KEYP));
+    memcpy(INQ, other.INQ, sizeof(INQ));
+    INQ_HEAD  = other.INQ_HEAD;
+    INQ_TAIL  = other.INQ_TAIL;
+    INPUT_NS  = other.INPUT_NS;
+
+    /* a stop (and stepping over it) belongs to the point the machine was at */
+    DBG_REASON = -1;
+    DBG_SKIP   = false;
+}
+
+/*
+    Drops the references on the memory pages and the ROM image.
+*/
+void CHIP8::release_memory() {
+    for(int p = 0; p < PAGES; p++) {
+        page_release(PAGE[p]);
+        PAGE[p] = NULL;
+    }
+    image_release(IMAGE);
+    IMAGE = NULL;
+}
+
+/*
+    Points PAGE at a table of COUNT empty entries: PAGE_TABLE for the 4KB memories,
+    allocated for the 64KB one (after release_memory, which empties the current one).
+*/
+void CHIP8::page_table(int count) {
+    if(PAGE != PAGE_TABLE) {
+        delete[] PAGE;
+    }
+    PAGE = count > MEM_PAGECOUNT ? new MEM_PAGE*[count] : PAGE_TABLE;
+    for(int p = 0; p < count; p++) {
+        PAGE[p] = NULL;
+    }
+}
+
+/*
+    Called before a write to a page someone else holds too: takes a private copy of it.
+*/
+void CHIP8::unshare(int p) {
+    MEM_PAGE *page = new MEM_PAGE;
+    page->refs.store(1, std::memory_order_relaxed);
+    memcpy(page->data, PAGE[p]->data, MEM_PAGESIZE);
+    page_release(PAGE[p]);
+    PAGE[p] = page;
+}
+
+/*
+    Returns the bytes used by this instance: the object itself,
+    plus the pages only it holds (written to, or left to it by the others) and the profiling / debug maps if allocated.
+*/
+size_t CHIP8::footprint() {
+    size_t bytes = sizeof(CHIP8);
+    for(int p = 0; p < PAGES; p++) {
+        if(PAGE[p]->refs.load(std::memory_order_relaxed) == 1) {
+            bytes += sizeof(MEM_PAGE);
+        }
+    }
+    if(PAGE != PAGE_TABLE) {
+        bytes += PAGES * sizeof(MEM_PAGE*);
+    }
+    if(XDISP != NULL) {
+        bytes += plane_count() * HIRES_HEIGHT * HIRES_WORDS * sizeof(uint64_t);
+    }
+    if(OP_CYCLES != NULL) {
+        bytes += 16 * sizeof(uint64_t);
+    }
+    if(DBG_MAP != NULL) {
+        bytes += DBG_MAPCOUNT * DBG_MAPSIZE;
+    }
+    return bytes;
+}
+
+/*
+
+    main function to load the ROM into CHIP instance.
+    Takes ROM path, SOUND MODE bit, VERBOSE (trace) MODE, (SINGLE)STEP MODE bit as parameters.
+    Returns 0 on successful execution
+    Returns -1 if unable to load ROM file.
+
+*/
+int CHIP8::load_rom(char* path, bool SND, bool VRB, bool STP) {
+    if(swap_rom(path) == -1) {
+        return -1;
+    }
+    this->MODE_SND = SND;
+    this->MODE_VRB = VRB;
+    this->MODE_STP = STP;
+    std::cout<<"loaded ROM successfully."<<std::endl;
+
+    return 0;
+}
+
+/*
+
+    Replaces the loaded ROM with the one at PATH and resets the machine.
+    The file is read completely before anything is touched,
+    so on failure the running game carries on.
+    Returns 0 on success, -1 if unable to load the ROM file.
+
+*/
+int CHIP8::swap_rom(char* path) {
+    std::ifstream rom_file(path, std::ios::binary);
+
+    if(!rom_file.is_open()){
+        std::cerr<<std::endl<< "file does not exist.";
+        return -1;
+    }
+
+    uint8_t rom[XO_ROMSIZE];
+    int     max  = VARIANT == VARIANT_XOCHIP ? XO_ROMSIZE : MAX_ROMSIZE;
+    int     size = 0;
+    char    data;
+    while(rom_file.get(data)){
+        if(size >= max){
+            std::cerr<< "file size too large";
+            return -1;
+        }
+        rom[size++] = (uint8_t)data;
+    }
+
+    image_release(IMAGE);
+    IMAGE = image_create(rom, size, VARIANT);
+    reset();
+
+    return 0;
+}
+
+/*
+
+    Switches the machine to VARIANT (VARIANT_CHIP8, VARIANT_SCHIP, VARIANT_XOCHIP):
+    memory of the variant's size with its fonts and no ROM, its display, and a reset.
+    The flag registers are cleared. Modes and attachments are kept.
+
+*/
+void CHIP8::set_variant(int variant) {
+    if(variant < VARIANT_CHIP8 || variant > VARIANT_XOCHIP) {
+        return;
+    }
+    release_memory();
+    VARIANT  = variant;
+    MEM_MASK = (variant == VARIANT_XOCHIP ? XO_MEMSIZE : MAX_MEMSIZE) - 1;
+    IMAGE    = variant == VARIANT_CHIP8 ? image_acquire(blank_image()) : image_create(NULL, 0, variant);
+    page_table(IMAGE->count);
+    PAGES    = IMAGE->count;
+
+    delete[] XDISP;
+    XDISP = variant == VARIANT_CHIP8 ? NULL : new uint64_t[plane_count() * HIRES_HEIGHT * HIRES_WORDS];
+    memset(FLAGS, 0x0, sizeof(FLAGS));
+
+    reset();
+}
+
+int CHIP8::get_variant() {
+    return VARIANT;
+}
+
+uint32_t CHIP8::get_memsize() {
+    return (uint32_t) MEM_MASK + 1;
+}
+
+/*
+    Bitplanes of the variant: 2 for XO-CHIP, 1 otherwise.
+*/
+int CHIP8::plane_count() {
+    return VARIANT == VARIANT_XOCHIP ? MAX_PLANES : 1;
+}
+
+/*
+    Returns the value of MODE_STP (single Step mode)
+*/
+bool CHIP8::get_STP() {
+    return MODE_STP;
+}
+
+/*
+    Returns the value of KEYP (key pressed or not)
+*/
+uint8_t CHIP8::get_key(int index) {
+    return KEYP[index & (MAX_KEYCOUNT - 1)];
+}
+
+/*
+    Returns the PIXEL value of display at DISP[POINT] (the bitplanes set there, see get_width)
+*/
+uint32_t CHIP8::get_pixel(int point) {
+    if(XDISP == NULL) {
+        return (DISP[point / MAX_WIDTH] >> (MAX_WIDTH - 1 - point % MAX_WIDTH)) & 0x1;
+    }
+    int      x     = point % HIRES_WIDTH;
+    int      y     = (point / HIRES_WIDTH) % HIRES_HEIGHT;
+    uint32_t value = 0;
+    for(int p = 0; p < plane_count(); p++) {
+        uint64_t word = XDISP[(p * HIRES_HEIGHT + y) * HIRES_WORDS + x / 64];
+        value |= ((word >> (63 - x % 64)) & 0x1) << p;
+    }
+    return value;
+}
+
+int CHIP8::get_width() {
+    return XDISP != NULL ? HIRES_WIDTH : MAX_WIDTH;
+}
+
+int CHIP8::get_height() {
+    return XDISP != NULL ? HIRES_HEIGHT : MAX_HEIGHT;
+}
+
+/*
+    Spreads the 8 pixels of byte B (MSB first) into 8 bytes of 0 / 1, the first pixel in the
+    lowest addressed byte: the copies of B the multiply makes do not overlap, so byte k gets
+    bit 7 - k in its top bit.
+*/
+static inline uint64_t spread_pixels(uint8_t b) {
+    uint64_t bytes = ((b * 0x8040201008040201ULL) & 0x8080808080808080ULL) >> 7;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bytes = __builtin_bswap64(bytes);
+#endif
+    return bytes;
+}
+
+/*
+    Writes the display to PIXELS (get_width() x get_height() bytes, as get_pixel):
+    the bitplanes are composited 8 pixels at a time, a plane's byte spread to 8 bytes and
+    shifted to its bit, instead of pixel by pixel.
+*/
+void CHIP8::get_frame(uint8_t *pixels) {
+    if(XDISP == NULL) {
+        for(int y = 0; y < MAX_HEIGHT; y++) {
+            for(int b = 0; b < 8; b++) {
+                uint64_t bytes = spread_pixels(DISP[y] >> (56 - 8 * b));
+                memcpy(pixels + y * MAX_WIDTH + 8 * b, &bytes, sizeof(bytes));
+            }
+        }
+        return;
+    }
+
+    int planes = plane_count();
+    for(int y = 0; y < HIRES_HEIGHT; y++) {
+        for(int w = 0; w < HIRES_WORDS; w++) {
+            for(int b = 0; b < 8; b++) {
+                uint64_t bytes = 0;
+                for(int p = 0; p < planes; p++) {
+                    uint64_t word = XDISP[(p * HIRES_HEIGHT + y) * HIRES_WORDS + w];
+                    bytes |= spread_pixels(word >> (56 - 8 * b)) << p;
+                }
+                memcpy(pixels + y * HIRES_WIDTH + w * 64 + 8 * b, &bytes, sizeof(bytes));
+            }
+        }
+    }
+}
+
+/*
+    Returns display row Y, one bit per pixel, MSB is x = 0.
+*/
+uint64_t CHIP8::get_row(int y) {
+    return DISP[y % MAX_HEIGHT];
+}
+
+/*
+    The display hash is the XOR, over the display words (DISP rows, then XDISP words), of a 64-bit
+    finalizer (MurmurHash3's) of the word keyed by its index, less that of a blank word:
+    a word changing is folded in with word_change, a blank display hashes to 0.
+*/
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline uint64_t word_change(int index, uint64_t from, uint64_t to) {
+    uint64_t key = (uint64_t) (index + 1) * 0x9e3779b97f4a7c15ULL;
+    return mix64(from ^ key) ^ mix64(to ^ key);
+}
+
+uint64_t CHIP8::frame_hash() {
+    return DISP_HASH;
+}
+
+void CHIP8::rehash_display() {
+    DISP_HASH = 0;
+    for(int y = 0; y < MAX_HEIGHT; y++) {
+        DISP_HASH ^= word_change(y, 0, DISP[y]);
+    }
+    for(int w = 0; XDISP != NULL && w < plane_count() * HIRES_HEIGHT * HIRES_WORDS; w++) {
+        DISP_HASH ^= word_change(MAX_HEIGHT + w, 0, XDISP[w]);
+    }
+}
+
+/*
+    Returns a hash of the machine (64-bit FNV-1a, a word at a time) for deduplicating states:
+    registers, the live part of the stack, timers, display, and the pages which differ from the ROM image.
+*/
+uint64_t CHIP8::state_hash() {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t word;
+
+    memcpy(&word, V, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ULL;
+    memcpy(&word, V + 8, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ULL;
+    word = (uint64_t) PC | (uint64_t) I << 16 | (uint64_t) (uint8_t) SP << 32 | (uint64_t) get_DT() << 40 | (uint64_t) get_ST() << 48;
+    hash = (hash ^ word) * 0x100000001b3ULL;
+    for(int s = 0; s <= SP; s++) {
+        hash = (hash ^ STACK[s]) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ DISP_HASH) * 0x100000001b3ULL;
+    if(XDISP != NULL) {
+        hash = (hash ^ (HIRES | PLANES << 1)) * 0x100000001b3ULL;
+    }
+    for(int p = 0; p < PAGES; p++) {
+        if(PAGE[p] == IMAGE->pages[p] || memcmp(PAGE[p]->data, IMAGE->pages[p]->data, MEM_PAGESIZE) == 0) {
+            continue;
+        }
+        hash = (hash ^ p) * 0x100000001b3ULL;
+        for(int w = 0; w < MEM_PAGESIZE; w += sizeof(word)) {
+            memcpy(&word, PAGE[p]->data + w, sizeof(word));
+            hash = (hash ^ word) * 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+/*
+    Writes the machine into STATE (padding zeroed).
+*/
+void CHIP8::save_state(MACHINE_STATE *state) {
+    memset(state, 0x0, sizeof(MACHINE_STATE));
+    memcpy(state->V, V, sizeof(V));
+    state->PC        = PC;
+    state->I         = I;
+    state->SP        = SP;
+    state->DT        = get_DT();
+    state->ST        = get_ST();
+    memcpy(state->KEYP, KEYP, sizeof(KEYP));
+    memcpy(state->STACK, STACK, sizeof(STACK));
+    state->RNG       = RNG;
+    state->CYCLES    = CYCLES;
+    state->INSTRS    = INSTRS;
+    state->NEXT_TICK = NEXT_TICK;
+    memcpy(state->DISP, DISP, sizeof(DISP));
+    for(int p = 0; p < MEM_PAGECOUNT; p++) {
+        memcpy(state->MEM + p * MEM_PAGESIZE, PAGE[p]->data, MEM_PAGESIZE);
+    }
+}
+
+/*
+    Loads the machine from STATE, saved from an instance with the same ROM.
+    Pages equal to the ROM image share its pages again, pending key events are dropped.
+*/
+void CHIP8::load_state(const MACHINE_STATE *state) {
+    memcpy(V, state->V, sizeof(V));
+    PC        = state->PC;
+    I         = state->I;
+    SP        = state->SP < 0 ? -1 : state->SP & (MAX_STACKSIZE - 1);
+    memcpy(KEYP, state->KEYP, sizeof(KEYP));
+    memcpy(STACK, state->STACK, sizeof(STACK));
+    RNG       = state->RNG;
+    CYCLES    = state->CYCLES;
+    INSTRS    = state->INSTRS;
+    NEXT_TICK = state->NEXT_TICK;
+    DT_END    = timer_end(state->DT);
+    ST_END    = timer_end(state->ST);
+    memcpy(DISP, state->DISP, sizeof(DISP));
+    rehash_display();
+
+    for(int p = 0; p < MEM_PAGECOUNT; p++) {
+        const uint8_t *data = state->MEM + p * MEM_PAGESIZE;
+        page_release(PAGE[p]);
+        if(memcmp(data, IMAGE->pages[p]->data, MEM_PAGESIZE) == 0) {
+            PAGE[p] = page_acquire(IMAGE->pages[p]);
+        } else {
+            PAGE[p] = new MEM_PAGE;
+            PAGE[p]->refs.store(1, std::memory_order_relaxed);
+            memcpy(PAGE[p]->data, data, MEM_PAGESIZE);
+        }
+    }
+
+    INQ_HEAD   = 0;
+    INQ_TAIL   = 0;
+    INPUT_NS   = 0;
+    draw_flag  = true;
+    DBG_REASON = -1;
+}
+
+/*
+    bit_mask is a helper function
+    takes word (2 bytes), a mask (2 bytes) which can be applied on word, and rightshift value.
+*/
+uint16_t CHIP8::bit_mask(uint16_t word, uint16_t mask, int rshift) {
+    return ((word & mask) >> rshift) ;
+}
+
+/*
+    Helper function which returns the value of drawflag
+*/
+bool CHIP8::get_drawflag() {
+    return draw_flag;
+}
+
+/*
+    Helper function to set drawflag value to VAL
+    True -> drawn to screen; False -> no screen update
+*/
+void CHIP8::set_drawflag(bool val) {
+    draw_flag = val;
+}
+
+/*
+    Register and memory getters and setters, used by the debugger.
+    Indices are wrapped to the size of the register file / stack / memory.
+*/
+uint8_t CHIP8::get_V(int index) {
+    return V[index & (MAX_REGCOUNT - 1)];
+}
+
+void CHIP8::set_V(int index, uint8_t val) {
+    V[index & (MAX_REGCOUNT - 1)] = val;
+}
+
+uint16_t CHIP8::get_PC() {
+    return PC;
+}
+
+void CHIP8::set_PC(uint16_t val) {
+    PC = val;
+}
+
+uint16_t CHIP8::get_I() {
+    return I;
+}
+
+void CHIP8::set_I(uint16_t val) {
+    I = val;
+}
+
+int8_t CHIP8::get_SP() {
+    return SP;
+}
+
+void CHIP8::set_SP(int8_t val) {
+    SP = val < 0 ? -1 : val & (MAX_STACKSIZE - 1);
+}
+
+uint8_t CHIP8::get_DT() {
+    return timer_value(DT_END);
+}
+
+void CHIP8::set_DT(uint8_t val) {
+    DT_END = timer_end(val);
+}
+
+uint8_t CHIP8::get_ST() {
+    return timer_value(ST_END);
+}
+
+void CHIP8::set_ST(uint8_t val) {
+    ST_END = timer_end(val);
+}
+
+uint16_t CHIP8::get_stack(int index) {
+    return STACK[index & (MAX_STACKSIZE - 1)];
+}
+
+void CHIP8::set_stack(int index, uint16_t val) {
+    STACK[index & (MAX_STACKSIZE - 1)] = val;
+}
+
+uint8_t CHIP8::get_fault() {
+    return FAULT;
+}
+
+uint16_t CHIP8::get_fault_pc() {
+    return FAULT_PC;
+}
+
+void CHIP8::clear_fault() {
+    FAULT    = 0;
+    FAULT_PC = 0;
+}
+
+/* name of the first fault in FAULT (FAULT_* bits), as chip8-fuzz names its crashes */
+const char *CHIP8::fault_name(uint8_t fault) {
+    if(fault & FAULT_STACKOVF)  return "stack-ovf";
+    if(fault & FAULT_STACKUNF)  return "stack-unf";
+    if(fault & FAULT_MEMOOB)    return "mem-oob";
+    if(fault & FAULT_PCOOB)     return "pc-oob";
+    if(fault & FAULT_KEYOOB)    return "key-oob";
+    return "none";
+}
+
+uint8_t CHIP8::read_mem(uint16_t addr) {
+    return mem_rd(addr);
+}
+
+void CHIP8::write_mem(uint16_t addr, uint8_t val) {
+    mem_wr(addr, val);
+}
+
+/*
+    Arms (ON = true) or disarms a breakpoint or watchpoint at ADDR.
+    MAP is one of DBG_BRK, DBG_WWR, DBG_WRD.
+    The bitmaps are only allocated once something is armed.
+*/
+void CHIP8::set_debugpoint(int map, uint16_t addr, bool on) {
+    if(map < 0 || map >= DBG_MAPCOUNT) {
+        return;
+    }
+    if(DBG_MAP == NULL) {
+        if(!on) {
+            return;
+        }
+        DBG_MAP = new uint8_t[DBG_MAPCOUNT * DBG_MAPSIZE];
+        memset(DBG_MAP, 0x0, DBG_MAPCOUNT * DBG_MAPSIZE);
+    }
+
+    addr &= MEM_MASK;
+    uint8_t *byte = &DBG_MAP[map * DBG_MAPSIZE + (addr >> 3)];
+    uint8_t  bit  = 1 << (addr & 0x7);
+
+    if(on && !(*byte & bit)) {
+        *byte |= bit;
+        DBG_ARMED++;
+    } else if(!on && (*byte & bit)) {
+        *byte &= ~bit;
+        DBG_ARMED--;
+    }
+}
+
+/*
+    Disarms every breakpoint and watchpoint.
+*/
+void CHIP8::clear_debugpoints() {
+    if(DBG_MAP != NULL) {
+        memset(DBG_MAP, 0x0, DBG_MAPCOUNT * DBG_MAPSIZE);
+    }
+    DBG_ARMED = 0;
+}
+
+/*
+    Returns the map (DBG_BRK, DBG_WWR, DBG_WRD) which caused the last DBG_STOP, -1 if none.
+*/
+int CHIP8::get_stop_reason() {
+    return DBG_REASON;
+}
+
+/*
+    Returns the address which caused the last DBG_STOP.
+*/
+uint16_t CHIP8::get_stop_addr() {
+    return DBG_ADDR;
+}
+
+/*
+    Clears the stop reason. If it was a breakpoint, the next cycle steps over it;
+    a watchpoint stops after its instruction, so a breakpoint at the current PC still stops.
+*/
+void CHIP8::resume() {
+    DBG_SKIP   = DBG_REASON == DBG_BRK;
+    DBG_REASON = -1;
+}
+
+/*
+    Clears the stop reason and steps over a breakpoint at the current PC, whatever stopped there:
+    for runners which moved the machine to the stop themselves (the rewind history).
+*/
+void CHIP8::step_over() {
+    DBG_SKIP   = true;
+    DBG_REASON = -1;
+}
+
+/*
+    Checks a memory access at ADDR against watchpoint map MAP.
+    Only called while something is armed.
+*/
+void CHIP8::dbg_access(uint16_t addr, int map) {
+    addr &= MEM_MASK;
+    if(DBG_MAP[map * DBG_MAPSIZE + (addr >> 3)] & (1 << (addr & 0x7))) {
+        DBG_REASON = map;
+        DBG_ADDR   = addr;
+    }
+}
+
+/*
+    Turns the timing model ON (timers tick at 60Hz of VIP machine cycles)
+    or OFF (timers tick once per instruction). The timers keep their values
+    across the change of clock.
+*/
+void CHIP8::set_timing(bool val) {
+    uint8_t dt = get_DT();
+    uint8_t st = get_ST();
+    MODE_TIM  = val;
+    NEXT_TICK = CYCLES + VIP_CYCLES_PER_FRAME;
+    set_DT(dt);
+    set_ST(st);
+}
+
+bool CHIP8::get_timing() {
+    return MODE_TIM;
+}
+
+/*
+    Seeds the xorshift generator behind Cxkk (0 is not a valid state).
+*/
+void CHIP8::set_seed(uint32_t seed) {
+    RNG = seed ? seed : 0x2545F491;
+}
+
+/*
+    Sets the edge coverage map cycle() counts (previous PC, PC) transitions in, NULL for none.
+*/
+void CHIP8::set_coverage(uint8_t *map) {
+    COV      = map;
+    COV_PREV = 0;
+}
+
+/*
+    Returns false for opcodes which fall through instr_exec without doing anything.
+*/
+bool CHIP8::instr_valid(uint16_t instruction) {
+    uint8_t N  = instruction & 0x000F;
+    uint8_t KK = instruction & 0x00FF;
+
+    switch(instruction >> 12) {
+        case 0x0: return instruction == 0x00E0 || instruction == 0x00EE;
+        case 0x5:
+        case 0x9: return N == 0x0;
+        case 0x8: return N <= 0x7 || N == 0xE;
+        case 0xE: return KK == 0x9E || KK == 0xA1;
+        case 0xF:
+            {
+                switch(KK) {
+                    case 0x07: case 0x0A: case 0x15: case 0x18: case 0x1E:
+                    case 0x29: case 0x33: case 0x55: case 0x65:
+                        return true;
+                }
+                return false;
+            }
+    }
+    return true;
+}
+
+/*
+    Sets the metrics registry instructions and draws are counted in, NULL for none.
+*/
+void CHIP8::set_metrics(METRICS *metrics) {
+    MTR = metrics;
+}
+
+/*
+    Cumulative counters, for profiling.
+*/
+uint64_t CHIP8::get_cycles() {
+    return CYCLES;
+}
+
+uint64_t CHIP8::get_instrs() {
+    return INSTRS;
+}
+
+/*
+    Returns the machine cycles spent on instructions with leading nibble M (0x0 - 0xF).
+*/
+uint64_t CHIP8::get_op_cycles(int M) {
+    if(OP_CYCLES == NULL) {
+        return 0;
+    }
+    return OP_CYCLES[M & 0xF];
+}
+
+/*
+    Turns the per-opcode machine cycle counters ON (allocated and zeroed) or OFF.
+*/
+void CHIP8::set_profiling(bool on) {
+    if(on && OP_CYCLES == NULL) {
+        OP_CYCLES = new uint64_t[16]();
+    } else if(!on) {
+        delete[] OP_CYCLES;
+        OP_CYCLES = NULL;
+    }
+}
+
+/*
+    Turns skipping the idle loops in MASK (FUSE_*) ON, 0 turns it OFF.
+*/
+void CHIP8::set_fusion(uint8_t mask) {
+    FUSE_MASK = mask & FUSE_IDLE;
+    if(FUSE_MASK && FUSE == NULL) {
+        FUSE = new uint8_t[MAX_MEMSIZE];
+    } else if(!FUSE_MASK) {
+        delete[] FUSE;
+        FUSE = NULL;
+    }
+    if(FUSE != NULL) {
+        memset(FUSE, 0x0, MAX_MEMSIZE);
+    }
+}
+
+/*
+    Returns the cost of INSTRUCTION in COSMAC VIP machine cycles (8 clocks each).
+
+    These are approximations of the original interpreter's routines,
+    rounded to whole machine cycles, e.g. 6xkk ~ 27us, 00E0 ~ 109us, Dxyn ~ 1ms for 8 rows.
+    Costs that depend on the operands (sprite rows, register count) scale with them.
+*/
+int CHIP8::instr_cost(uint16_t instruction) {
+    uint8_t  X    = (instruction & 0x0F00) >> 8;
+    uint8_t  N    = (instruction & 0x000F);
+    uint8_t  KK   = (instruction & 0x00FF);
+
+    switch(instruction >> 12) {
+        case 0x0:
+            {
+                if(instruction == 0x00E0) return 24;    /* CLS, clears 256 bytes of display RAM     */
+                if(instruction == 0x00EE) return 10;    /* RET                                      */
+                return 10;
+            }
+        case 0x1: return 12;                            /* JP                                       */
+        case 0x2: return 26;                            /* CALL                                     */
+        case 0x3:
+        case 0x4: return 10;                            /* SE / SNE Vx, byte                        */
+        case 0x5:
+        case 0x9: return 14;                            /* SE / SNE Vx, Vy                          */
+        case 0x6: return 6;                             /* LD Vx, byte                              */
+        case 0x7: return 10;                            /* ADD Vx, byte                             */
+        case 0x8: return 44;                            /* ALU ops go through a self-modified stub  */
+        case 0xA: return 12;                            /* LD I, addr                               */
+        case 0xB: return 22;                            /* JP V0, addr                              */
+        case 0xC: return 36;                            /* RND                                      */
+        case 0xD: return 68 + 46 * N;                   /* DRW, per row shift, XOR and collision    */
+        case 0xE: return 14;                            /* SKP / SKNP                               */
+        case 0xF:
+            {
+                switch(KK) {
+                    case 0x07: return 10;
+                    case 0x0A: return 8;                /* per poll while waiting                   */
+                    case 0x15: return 10;
+                    case 0x18: return 10;
+                    case 0x1E: return 16;
+                    case 0x29: return 20;
+                    case 0x33: return 84 + 18 * 3;      /* BCD by repeated subtraction              */
+                    case 0x55:
+                    case 0x65: return 14 + 14 * (X + 1);
+                }
+                return 10;
+            }
+    }
+    return 10;
+}
+
+/*
+
+    Performs a single cycle of instruction execution.
+    Returns 0 on success, -1 on error,
+    DBG_STOP if a breakpoint at PC or a watchpoint was hit (see get_stop_reason()).
+
+*/
+int CHIP8::cycle() {
+
+    /*
+        Each insturction is 16-bits, big-endian.
+        so we get the first byte and LEFTSHIFT it by 8,
+        then get the next byte and OR it.
+        then we send this instruction to the exec unit,
+        which decodes it and executes it
+    */
+
+    if(PC > MEM_MASK) {
+        fault_at(FAULT_PCOOB, true, PC);
+        std::cerr << "memory overflow";
+        return -1;
+    }
+
+    /* edge coverage, AFL style: the previous location is shifted so A->B and B->A differ */
+    if(COV) {
+        uint16_t loc = (PC * 0x9E37) & (COV_MAPSIZE - 1);
+        COV[loc ^ COV_PREV]++;
+        COV_PREV = loc >> 1;
+    }
+
+    /* key events due at this instruction */
+    if(INQ_HEAD != INQ_TAIL && INQ[INQ_HEAD].instr <= INSTRS) {
+        apply_inputs();
+    }
+
+    /* breakpoints are only looked up while something is armed */
+    if(DBG_ARMED) {
+        if(!DBG_SKIP && (DBG_MAP[DBG_BRK * DBG_MAPSIZE + (PC >> 3)] & (1 << (PC & 0x7)))) {
+            DBG_REASON = DBG_BRK;
+            DBG_ADDR   = PC;
+            return DBG_STOP;
+        }
+        DBG_SKIP = false;
+    }
+
+    uint16_t instruction = ( ( mem_rd(PC) << 8 ) |  mem_rd(PC+1) );
+    /* go to next address +2 bytes */
+    PC += 2;
+
+    if(instr_exec(instruction) == -1) {
+        std::cerr<<"error executing instruction.";
+        return -1;
+    }
+
+    retire(instruction);
+
+    /* a watchpoint stops after the instruction which touched it */
+    if(DBG_ARMED && DBG_REASON != -1) {
+        return DBG_STOP;
+    }
+
+    return 0;
+}
+
+/*
+    Accounts for an executed INSTRUCTION: charges its machine cycles,
+    counts it and moves the timer clock. Shared by cycle() and the idle loops.
+*/
+void CHIP8::retire(uint16_t instruction) {
+
+    /*
+        charge the instruction its machine cycles.
+        on the VIP a sprite draw waits for the display interrupt,
+        so with the timing model Dxyn takes the rest of the frame (not on SUPER-CHIP / XO-CHIP).
+    */
+    uint64_t cost = instr_cost(instruction);
+    if(MODE_TIM && (instruction >> 12) == 0xD && XDISP == NULL && CYCLES + cost < NEXT_TICK) {
+        cost = NEXT_TICK - CYCLES;
+    }
+    CYCLES += cost;
+    INSTRS++;
+    if(OP_CYCLES) {
+        OP_CYCLES[instruction >> 12] += cost;
+    }
+    if(MTR) {
+        metrics_inc(MTR->instructions);
+    }
+
+    /*
+        with the timing model the timers tick at 60Hz of machine cycles (NEXT_TICK),
+        otherwise once per instruction (INSTRS): either way the clock has moved,
+        and the timers are worked out from it when read.
+    */
+    if(MODE_TIM) {
+        while(CYCLES >= NEXT_TICK) {
+            NEXT_TICK += VIP_CYCLES_PER_FRAME;
+        }
+    }
+}
+
+/*
+    Retires INSTRUCTION N times in one step, for instructions whose cost does not depend
+    on the time (not Dxyn): the same state as N calls of retire().
+*/
+void CHIP8::retire_many(uint16_t instruction, uint64_t n) {
+    uint64_t cost = instr_cost(instruction);
+
+    CYCLES += n * cost;
+    INSTRS += n;
+    if(OP_CYCLES) {
+        OP_CYCLES[instruction >> 12] += n * cost;
+    }
+    if(MTR) {
+        metrics_inc(MTR->instructions, n);
+    }
+
+    if(MODE_TIM && CYCLES >= NEXT_TICK) {
+        NEXT_TICK += ((CYCLES - NEXT_TICK) / VIP_CYCLES_PER_FRAME + 1) * VIP_CYCLES_PER_FRAME;
+    }
+}
+
+/*
+    Retires INSTRUCTION as many times as it takes CYCLES to reach LIMIT (at least once), in one step.
+    Only for instructions which change nothing but the time (a jump to itself, a key poll).
+*/
+void CHIP8::retire_until(uint16_t instruction, uint64_t limit) {
+    uint64_t cost = instr_cost(instruction);
+    retire_many(instruction, CYCLES < limit ? (limit - CYCLES + cost - 1) / cost : 1);
+}
+
+/*
+    Runs instructions until the current frame's machine cycles are spent,
+    i.e. until the next 60Hz tick (the frame boundary) with the timing model ON.
+    Returns 0 on success, or the first non-zero status of cycle() (-1, DBG_STOP).
+*/
+int CHIP8::run_frame() {
+    return run_to(MODE_TIM ? NEXT_TICK : CYCLES + VIP_CYCLES_PER_FRAME);
+}
+
+bool CHIP8::key_waiting() {
+    if(mem_rd(PC) >> 4 != 0xF || mem_rd(PC + 1) != 0x0A || INQ_HEAD != INQ_TAIL) {
+        return false;
+    }
+    for(int k = 0; k < MAX_KEYCOUNT; k++) {
+        if(KEYP[k] == KEY_DOWN) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    Lets FRAMES frames pass on a key wait (key_waiting()), retiring the Fx0A poll up to
+    the end of the last one like run_frame() would.
+*/
+void CHIP8::wait_frames(uint64_t frames) {
+    if(frames == 0 || !key_waiting()) {
+        return;
+    }
+    uint16_t instruction = (mem_rd(PC) << 8) | mem_rd(PC + 1);
+    uint64_t frame_end   = MODE_TIM ? NEXT_TICK : CYCLES + VIP_CYCLES_PER_FRAME;
+    retire_until(instruction, frame_end + (frames - 1) * VIP_CYCLES_PER_FRAME);
+}
+
+uint64_t CHIP8::next_timer_event() {
+    uint64_t clock = timer_clock();
+    uint64_t end   = TIMER_NEVER;
+    if(DT_END > clock) {
+        end = DT_END;
+    }
+    if(ST_END > clock) {
+        end = std::min(end, ST_END);
+    }
+    if(end == TIMER_NEVER || !MODE_TIM) {
+        return end;
+    }
+    /* the timer is 0 from the tick before END on: NEXT_TICK moves to END once CYCLES reaches it */
+    return end - VIP_CYCLES_PER_FRAME;
+}
+
+/*
+    Runs instructions until CYCLES reaches FRAME_END, skipping the idle loops if that is ON.
+    Returns 0 on success, or the first non-zero status of cycle() (-1, DBG_STOP).
+*/
+int CHIP8::run_to(uint64_t frame_end) {
+    /* idle loops are only skipped while nothing has to look at every instruction */
+    bool skip = FUSE != NULL && !DBG_ARMED && COV == NULL && !MODE_VRB;
+    while(CYCLES < frame_end) {
+        if(skip && FUSE[PC & (MAX_MEMSIZE - 1)] != FUSE_NONE && INQ_HEAD == INQ_TAIL && exec_fused(frame_end)) {
+            continue;
+        }
+        int status = cycle();
+        if(status != 0) {
+            return status;
+        }
+    }
+    return 0;
+}
+
+/*
+
+    Run-until: the predicates are split once, before running, into the cheap ones
+    (registers, PC, memory, counters) which are checked after every instruction,
+    and the expensive ones (frame number, display hash) which are only checked at
+    frame boundaries. Without cheap predicates whole frames run through run_to(),
+    idle loops skipped.
+
+*/
+
+/* true if the (compiled) cheap predicate P holds */
+inline bool CHIP8::until_fired(const UNTIL_PRED& p) {
+    switch(p.kind) {
+        case UNTIL_PC:      return PC == p.value;
+        case UNTIL_INSTRS:  return INSTRS >= p.value;
+        case UNTIL_REG:     return V[p.arg] != p.value;
+        case UNTIL_REGEQ:   return V[p.arg] == p.value;
+        case UNTIL_MEM:     return mem_rd(p.arg) != p.value;
+    }
+    return false;
+}
+
+int CHIP8::run_until(const UNTIL_PRED *preds, int count, uint64_t max_frames) {
+    if(count > UNTIL_MAXPREDS) {
+        return -1;
+    }
+
+    UNTIL_PRED cheap[UNTIL_MAXPREDS];
+    int        cheap_index[UNTIL_MAXPREDS];
+    int        cheap_count = 0;
+    int        frame_index[UNTIL_MAXPREDS];
+    int        frame_count = 0;
+
+    for(int i = 0; i < count; i++) {
+        UNTIL_PRED p = preds[i];
+        switch(p.kind) {
+            case UNTIL_REG:
+                p.arg  &= MAX_REGCOUNT - 1;
+                p.value = V[p.arg];
+                break;
+            case UNTIL_REGEQ:
+                p.arg  &= MAX_REGCOUNT - 1;
+                break;
+            case UNTIL_MEM:
+                p.arg  &= MEM_MASK;
+                p.value = mem_rd(p.arg);
+                break;
+            case UNTIL_PC:
+            case UNTIL_INSTRS:
+                break;
+            case UNTIL_FRAME:
+            case UNTIL_HASH:
+                frame_index[frame_count++] = i;
+                continue;
+            default:
+                return -1;
+        }
+        cheap[cheap_count]         = p;
+        cheap_index[cheap_count++] = i;
+    }
+
+    uint64_t last_frame = CYCLES / VIP_CYCLES_PER_FRAME + max_frames;
+    while(true) {
+        uint64_t frame_end = (CYCLES / VIP_CYCLES_PER_FRAME + 1) * VIP_CYCLES_PER_FRAME;
+
+        if(cheap_count == 0) {
+            int status = run_to(frame_end);
+            if(status != 0) {
+                return status == DBG_STOP ? UNTIL_BREAK : -1;
+            }
+        } else {
+            while(CYCLES < frame_end) {
+                int status = cycle();
+                if(status != 0) {
+                    return status == DBG_STOP ? UNTIL_BREAK : -1;
+                }
+                for(int p = 0; p < cheap_count; p++) {
+                    if(until_fired(cheap[p])) {
+                        return cheap_index[p];
+                    }
+                }
+            }
+        }
+
+        for(int p = 0; p < frame_count; p++) {
+            const UNTIL_PRED& pred = preds[frame_index[p]];
+            if((pred.kind == UNTIL_FRAME && CYCLES / VIP_CYCLES_PER_FRAME >= pred.value) ||
+               (pred.kind == UNTIL_HASH  && frame_hash() == pred.value)) {
+                return frame_index[p];
+            }
+        }
+        if(CYCLES / VIP_CYCLES_PER_FRAME >= last_frame) {
+            return UNTIL_EXPIRED;
+        }
+    }
+}
+
+/*
+
+    Idle loops: sequences of opcodes which only poll the delay timer or the keys (or
+    jump to themselves), retired up to the frame end without running them one by one.
+
+    Every address is classified once (FUSE table) from the power-on memory; a
+    loop is only skipped while the pages holding it are still the ROM image's
+    (never written), so self-modifying code always goes through cycle().
+    The passes are retired with the same cycles, timers and counters as cycle()
+    by cycle() would give, and a jump or skip into the middle of one just runs from there.
+
+*/
+
+/* FUSE table entries */
+enum FUSEKIND {FUSEK_WAIT = 1, FUSEK_SPIN, FUSEK_KEY};
+
+/*
+    Returns the FUSE table entry for the idle loop starting at PC, FUSE_NONE if there is none.
+*/
+uint8_t CHIP8::fuse_classify(uint16_t pc) {
+    if(pc > MAX_MEMSIZE - 6) {
+        return FUSE_NONE;
+    }
+    uint16_t op0 = (mem_rd(pc)     << 8) | mem_rd(pc + 1);
+    uint16_t op1 = (mem_rd(pc + 2) << 8) | mem_rd(pc + 3);
+    uint16_t op2 = (mem_rd(pc + 4) << 8) | mem_rd(pc + 5);
+
+    if((FUSE_MASK & FUSE_SPIN) && op0 == (0x1000 | pc)) {
+        return FUSEK_SPIN;
+    }
+    if((FUSE_MASK & FUSE_KEY) && (op0 & 0xF0FF) == 0xF00A) {
+        return FUSEK_KEY;
+    }
+    if((FUSE_MASK & FUSE_WAIT) && (op0 & 0xF0FF) == 0xF007 &&
+       op1 == (0x3000 | (op0 & 0x0F00)) && (op2 >> 12) == 0x1) {
+        return FUSEK_WAIT;
+    }
+    return FUSE_NONE;
+}
 
-    /* initialise font set */
-    uint8_t font_set[MAX_FONTCOUNT] {
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
-
-    /* load font set in memory from 0x00 */
-    for(int i=0; i < 80; i++) {
-        MEM[i] = font_set[i];
+/*
+    Skips the idle loop at PC, stopping once CYCLES reaches LIMIT.
+    Returns false (and runs nothing) if there is none.
+*/
+bool CHIP8::exec_fused(uint64_t limit) {
+    uint16_t start = PC;
+    if(start >= MAX_MEMSIZE) {
+        return false;
     }
 
     /*
-        Seed the RNG
+        a loop is at most 3 opcodes (6 bytes), so it spans at most two pages.
+        a written page stays private until reset(), so the address is given up for good.
     */
-    srand(time(NULL));
+    int first = start >> MEM_PAGESHIFT;
+    int last  = std::min(start + 5, MAX_MEMSIZE - 1) >> MEM_PAGESHIFT;
+    if(PAGE[first] != IMAGE->pages[first] || PAGE[last] != IMAGE->pages[last]) {
+        FUSE[start] = FUSE_NONE;
+        return false;
+    }
 
-}
+    uint8_t fuse = FUSE[start];
+    if(fuse == 0) {
+        fuse = FUSE[start] = fuse_classify(start);
+    }
+    if(fuse == FUSE_NONE) {
+        return false;
+    }
 
-/*
+    uint16_t op0 = (mem_rd(start) << 8) | mem_rd(start + 1);
+    uint16_t op1 = (mem_rd(start + 2) << 8) | mem_rd(start + 3);
 
-    CHIP8 Destructor
+    switch(fuse) {
+        case FUSEK_SPIN:
+            {
+                /* nothing but time passes until the frame ends */
+                retire_until(op0, limit);
+                break;
+            }
 
-*/
-CHIP8::~CHIP8() {
-    std::cout<<"CHIP8 instance stopped."<<std::endl;
-}
+        case FUSEK_KEY:
+            {
+                /* no key can go down before the frame ends, so it polls until then */
+                for(int k = 0; k < MAX_KEYCOUNT; k++) {
+                    if(KEYP[k] == KEY_DOWN) {
+                        return false;
+                    }
+                }
+                retire_until(op0, limit);
+                break;
+            }
 
-/*
+        case FUSEK_WAIT:
+            {
+                /* loops in place while it jumps back to itself and DT is not 0 */
+                uint8_t  X   = (op0 & 0x0F00) >> 8;
+                uint16_t op2 = (mem_rd(start + 4) << 8) | mem_rd(start + 5);
 
-    main function to load the ROM into CHIP instance.
-    Takes ROM path, SOUND MODE bit, VERBOSE (trace) MODE, (SINGLE)STEP MODE bit as parameters.
-    Returns 0 on successful execution
-    Returns -1 if unable to load ROM file.
+                /*
+                    with the timing model DT only changes at the next tick, so while it is not 0
+                    every pass up to there is the same: the passes which end before LIMIT and
+                    the tick are retired in one step, and the loop below runs the rest.
+                */
+                uint64_t pass = instr_cost(op0) + instr_cost(op1) + instr_cost(op2);
+                uint64_t end  = std::min(limit, NEXT_TICK);
+                if(MODE_TIM && (op2 & 0x0FFF) == start && get_DT() != 0 && CYCLES + pass < end) {
+                    uint64_t n = (end - CYCLES - 1) / pass;
+                    V[X] = get_DT();
+                    retire_many(op0, n);
+                    retire_many(op1, n);
+                    retire_many(op2, n);
+                    PC = start;
+                }
+                do {
+                    V[X] = get_DT();
+                    PC   = start + 2;
+                    retire(op0);
+                    if(CYCLES >= limit) {
+                        break;
+                    }
+                    PC = V[X] == 0 ? start + 6 : start + 4;
+                    retire(op1);
+                    if(PC == start + 6 || CYCLES >= limit) {
+                        break;
+                    }
+                    PC = op2 & 0x0FFF;
+                    retire(op2);
+                } while(PC == start && CYCLES < limit);
+                break;
+            }
+    }
+    return true;
+}
 
+/*
+    Queues key KEY going to VAL before instruction number INSTR executes,
+    so input lands at the same point of the program on every run.
+    HOST_NS is the host time the event was received.
+    Returns 0 on success, -1 if the queue is full.
 */
-int CHIP8::load_rom(char* path, bool SND, bool VRB, bool STP) {
-    std::ifstream rom_file(path, std::ios::binary);
-
-    if(!rom_file.is_open()){
-        std::cerr<<std::endl<< "file does not exist.";
+int CHIP8::queue_key(int key, int val, uint64_t instr, uint64_t host_ns) {
+    uint8_t next = (INQ_TAIL + 1) & (INPUT_QSIZE - 1);
+    if(next == INQ_HEAD) {
         return -1;
     }
+    INQ[INQ_TAIL].instr   = instr;
+    INQ[INQ_TAIL].host_ns = host_ns;
+    INQ[INQ_TAIL].key     = key & (MAX_KEYCOUNT - 1);
+    INQ[INQ_TAIL].val     = val;
+    INQ_TAIL = next;
+    return 0;
+}
 
-    char data;
-    for(int i=PC_STARTADR; rom_file.get(data); i++){
-        if(i >= MAX_MEMSIZE){
-            std::cerr<< "file size too large";
-            return -1;
+/*
+    Applies every queued key event which is due at the current instruction.
+*/
+void CHIP8::apply_inputs() {
+    while(INQ_HEAD != INQ_TAIL && INQ[INQ_HEAD].instr <= INSTRS) {
+        KEYP[INQ[INQ_HEAD].key] = INQ[INQ_HEAD].val;
+        if(INPUT_NS == 0) {
+            INPUT_NS = INQ[INQ_HEAD].host_ns;
         }
-        MEM[i] = (uint8_t)data;
+        INQ_HEAD = (INQ_HEAD + 1) & (INPUT_QSIZE - 1);
     }
-    this->MODE_SND = SND;
-    this->MODE_VRB = VRB;
-    this->MODE_STP = STP;
-    std::cout<<"loaded ROM successfully."<<std::endl;
-
-    return 0;
 }
 
 /*
-    Returns the value of MODE_STP (single Step mode)
+    Returns the host time of the oldest key event applied since the last call (0 if none),
+    the frontend calls this when it presents a changed frame.
 */
-bool CHIP8::get_STP() {
-    return MODE_STP;
+uint64_t CHIP8::take_input_stamp() {
+    uint64_t stamp = INPUT_NS;
+    INPUT_NS = 0;
+    return stamp;
 }
 
 /*
-    Returns the value of KEYP (key pressed or not)
+    sets KEYP (key pressed to VAL).
 */
-uint8_t CHIP8::get_key(int index) {
-    return KEYP[index];
+void CHIP8::set_key(int key, int val) {
+    KEYP[key & (MAX_KEYCOUNT - 1)] = val;
 }
 
+
 /*
-    Returns the PIXEL value of display at DISP[POINT]
+    Skips the next instruction. On XO-CHIP that is 4 bytes if it is F000 nnnn:
+    looked at out of line, so the CHIP-8 skips stay a compare and an add.
 */
-uint32_t CHIP8::get_pixel(int point) {
-    return DISP[point];
+void CHIP8::skip_long() {
+    if(mem_rd(PC - 2) == 0xF0 && mem_rd(PC - 1) == 0x00) {
+        PC += 2;
+    }
+}
+
+inline void CHIP8::skip() {
+    PC += 2;
+    if(MEM_MASK != MAX_MEMSIZE - 1) {
+        skip_long();
+    }
 }
 
 /*
-    bit_mask is a helper function
-    takes word (2 bytes), a mask (2 bytes) which can be applied on word, and rightshift value.
+    Doubles every bit of a 16-bit sprite row (abc... -> aabbcc...), for low resolution on XDISP.
 */
-uint16_t CHIP8::bit_mask(uint16_t word, uint16_t mask, int rshift) {
-    return ((word & mask) >> rshift) ;
+static inline uint32_t double_bits(uint32_t bits) {
+    bits = (bits | bits << 8) & 0x00FF00FF;
+    bits = (bits | bits << 4) & 0x0F0F0F0F;
+    bits = (bits | bits << 2) & 0x33333333;
+    bits = (bits | bits << 1) & 0x55555555;
+    return bits | bits << 1;
 }
 
 /*
-    Helper function which returns the value of drawflag
+    Clears the bitplanes in MASK.
 */
-bool CHIP8::get_drawflag() {
-    return draw_flag;
+void CHIP8::clear_planes(uint8_t mask) {
+    for(int p = 0; p < plane_count(); p++) {
+        if(mask & (1 << p)) {
+            memset(&XDISP[p * HIRES_HEIGHT * HIRES_WORDS], 0x0, HIRES_HEIGHT * HIRES_WORDS * sizeof(uint64_t));
+        }
+    }
+    rehash_display();
 }
 
 /*
-    Helper function to set drawflag value to VAL
-    True -> drawn to screen; False -> no screen update
+    Dxyn on XDISP (SUPER-CHIP / XO-CHIP), set VF = collision.
+    n = 0 draws a 16 x 16 sprite (2 bytes a row). In low resolution each pixel is a 2 x 2 block,
+    the sprite row is widened with double_bits and drawn on two rows.
+    SUPER-CHIP clips sprites at the edges, XO-CHIP wraps them around like CHIP-8.
+    With several planes selected, each plane's sprite follows the previous one in memory.
+
+    A sprite row (up to 32 bits once doubled) is put at the top of a word and split over the two
+    words of the display row with two shifts, then XORed / checked for collision a word at a time.
 */
-void CHIP8::set_drawflag(bool val) {
-    draw_flag = val;
+void CHIP8::draw_ext(uint8_t X, uint8_t Y, uint8_t N) {
+    int      scale  = HIRES ? 1 : 2;
+    int      rows   = N ? N : 16;
+    int      bytes  = N ? 1 : 2;
+    int      width  = 8 * bytes * scale;
+    int      x      = (V[X] * scale) % HIRES_WIDTH;
+    int      y      = (V[Y] * scale) % HIRES_HEIGHT;
+    bool     wrap   = VARIANT == VARIANT_XOCHIP;
+    uint16_t addr   = I;
+
+    V[0xF] = 0;
+    for(int p = 0; p < plane_count(); p++) {
+        if(!(PLANES & (1 << p))) {
+            continue;
+        }
+        uint64_t *plane = &XDISP[p * HIRES_HEIGHT * HIRES_WORDS];
+        for(int r = 0; r < rows; r++, addr += bytes) {
+            if(DBG_ARMED) {
+                for(int b = 0; b < bytes; b++) {
+                    dbg_access(addr + b, DBG_WRD);
+                }
+            }
+            uint32_t bits = bytes == 2 ? (mem_rd(addr) << 8 | mem_rd(addr + 1)) : mem_rd(addr);
+            if(scale == 2) {
+                bits = double_bits(bits);
+            }
+            uint64_t top = (uint64_t) bits << (64 - width);
+            uint64_t left, right;
+            if(x < 64) {
+                left  = top >> x;
+                right = x ? top << (64 - x) : 0;
+            } else {
+                right = top >> (x - 64);
+                left  = (wrap && x > 64) ? top << (128 - x) : 0;
+            }
+
+            for(int s = 0; s < scale; s++) {
+                int line = y + r * scale + s;
+                if(line >= HIRES_HEIGHT) {
+                    if(!wrap) {
+                        break;
+                    }
+                    line %= HIRES_HEIGHT;
+                }
+                uint64_t *row   = &plane[line * HIRES_WORDS];
+                int       index = MAX_HEIGHT + (int) (row - XDISP);
+                if((row[0] & left) | (row[1] & right)) {
+                    V[0xF] = 1;
+                }
+                DISP_HASH ^= word_change(index, row[0], row[0] ^ left) ^ word_change(index + 1, row[1], row[1] ^ right);
+                row[0] ^= left;
+                row[1] ^= right;
+            }
+        }
+    }
+    /* ADDR went past the sprite bytes of every plane drawn */
+    fault(FAULT_MEMOOB, I + (uint16_t) (addr - I) > MEM_MASK + 1);
+    set_drawflag(true);
+    if(MTR) {
+        metrics_inc(MTR->draws);
+    }
 }
 
 /*
+    Scrolls the selected bitplanes by DX pixels right (negative: left) and DY down (negative: up),
+    pixels of XDISP (|DX| < 64, |DY| < 64). Rows move with memmove, columns a word at a time
+    with the bits crossing between the two words of a row shifted over.
+*/
+void CHIP8::scroll(int dx, int dy) {
+    for(int p = 0; p < plane_count(); p++) {
+        if(!(PLANES & (1 << p))) {
+            continue;
+        }
+        uint64_t *plane = &XDISP[p * HIRES_HEIGHT * HIRES_WORDS];
+        size_t    row   = HIRES_WORDS * sizeof(uint64_t);
+
+        if(dy > 0) {
+            memmove(plane + dy * HIRES_WORDS, plane, (HIRES_HEIGHT - dy) * row);
+            memset(plane, 0x0, dy * row);
+        } else if(dy < 0) {
+            memmove(plane, plane - dy * HIRES_WORDS, (HIRES_HEIGHT + dy) * row);
+            memset(plane + (HIRES_HEIGHT + dy) * HIRES_WORDS, 0x0, -dy * row);
+        }
 
-    Performs a single cycle of instruction execution.
+        for(int y = 0; dx != 0 && y < HIRES_HEIGHT; y++) {
+            uint64_t *words = &plane[y * HIRES_WORDS];
+            if(dx > 0) {
+                words[1] = (words[1] >> dx) | (words[0] << (64 - dx));
+                words[0] >>= dx;
+            } else {
+                words[0] = (words[0] << -dx) | (words[1] >> (64 + dx));
+                words[1] <<= -dx;
+            }
+        }
+    }
+    rehash_display();
+    set_drawflag(true);
+}
 
+/*
+    Executes the SUPER-CHIP / XO-CHIP instructions instr_exec hands over (only for those variants):
+    kept out of line so the CHIP-8 dispatch stays as small as it was.
 */
-int CHIP8::cycle() {
+void CHIP8::instr_ext(uint16_t instruction) {
+    uint8_t X  = bit_mask(instruction, 0x0F00, 8);
+    uint8_t Y  = bit_mask(instruction, 0x00F0, 4);
+    uint8_t N  = bit_mask(instruction, 0x000F, 0);
+    uint8_t KK = bit_mask(instruction, 0x00FF, 0);
 
-    /*
-        Each insturction is 16-bits, big-endian.
-        so we get the first byte and LEFTSHIFT it by 8,
-        then get the next byte and OR it.
-        then we send this instruction to the exec unit,
-        which decodes it and executes it
-    */
+    switch(instruction >> 12) {
 
-    if(PC >= MAX_MEMSIZE) {
-        std::cerr << "memory overflow";
-        return -1;
-    }
-    uint16_t instruction = ( ( MEM[PC] << 8 ) |  MEM[PC+1] );
-    /* go to next address +2 bytes */
-    PC += 2;
+        case 0x0:
+            {
+                /*
+                    00Cn - SCD nibble / 00Dn - SCU nibble (XO-CHIP)
+                    Scroll the display down / up by n pixels.
+                */
+                if((instruction & 0xFFF0) == 0x00C0) {
+                    scroll(0, HIRES ? N : 2 * N);
+                } else if((instruction & 0xFFF0) == 0x00D0 && VARIANT == VARIANT_XOCHIP) {
+                    scroll(0, HIRES ? -N : -2 * N);
+                }
 
-    if(instr_exec(instruction) == -1) {
-        std::cerr<<"error executing instruction.";
-        return -1;
-    }
+                switch(instruction) {
+                    /*
+                        00FB - SCR / 00FC - SCL
+                        Scroll the display right / left by 4 pixels.
+                    */
+                    case 0x00FB:
+                    case 0x00FC:
+                        {
+                            int dx = HIRES ? 4 : 8;
+                            scroll(instruction == 0x00FB ? dx : -dx, 0);
+                            break;
+                        }
 
-    if(DT > 0) {
-        DT--;
-    } 
+                    /*
+                        00FD - EXIT
+                        Exit the interpreter: the machine stays on this instruction.
+                    */
+                    case 0x00FD:
+                        {
+                            PC -= 2;
+                            break;
+                        }
 
-    if(ST > 0) {
-        ST--;
-    } 
+                    /*
+                        00FE - LOW / 00FF - HIGH
+                        Switch to 64 x 32 / 128 x 64, and clear the display.
+                    */
+                    case 0x00FE:
+                    case 0x00FF:
+                        {
+                            HIRES = instruction == 0x00FF;
+                            clear_planes(0xFF);
+                            set_drawflag(true);
+                            break;
+                        }
+                }
+                break;
+            }
 
-    return 0;
-}
+        case 0x5:
+            {
+                /*
+                    XO-CHIP: 5xy2 - LD [I], Vx - Vy / 5xy3 - LD Vx - Vy, [I]
+                    Store / read registers Vx through Vy (either way round) at I, I is left as it is.
+                */
+                int step = X <= Y ? 1 : -1;
+                fault(FAULT_MEMOOB, I + abs(X - Y) > MEM_MASK);
+                for(int i = 0, r = X; i <= abs(X - Y); i++, r += step) {
+                    if(DBG_ARMED) {
+                        dbg_access(I + i, N == 0x2 ? DBG_WWR : DBG_WRD);
+                    }
+                    if(N == 0x2) {
+                        mem_wr(I + i, V[r]);
+                    } else if(N == 0x3) {
+                        V[r] = mem_rd(I + i);
+                    }
+                }
+                break;
+            }
 
-/*
-    sets KEYP (key pressed to VAL).
-*/
-void CHIP8::set_key(int key, int val) {
-    KEYP[key] = val;
-}
+        case 0xF:
+            {
+                switch(KK) {
+                    /*
+                        XO-CHIP: F000 nnnn - LD I, long addr
+                        Set I = the 16-bit word after the instruction.
+                    */
+                    case 0x00:
+                        {
+                            if(X == 0x0 && VARIANT == VARIANT_XOCHIP) {
+                                I   = (mem_rd(PC) << 8) | mem_rd(PC + 1);
+                                PC += 2;
+                            }
+                            break;
+                        }
+
+                    /*
+                        XO-CHIP: Fn01 - PLANE n
+                        Select the bitplanes drawn, cleared and scrolled (bit per plane).
+                    */
+                    case 0x01:
+                        {
+                            if(VARIANT == VARIANT_XOCHIP) {
+                                PLANES = X & 0x3;
+                            }
+                            break;
+                        }
+
+                    /*
+                        XO-CHIP: F002 - AUDIO
+                        Load the 16-byte audio pattern from I.
+                    */
+                    case 0x02:
+                        {
+                            if(X == 0x0 && VARIANT == VARIANT_XOCHIP) {
+                                fault(FAULT_MEMOOB, I + AUDIO_SIZE > MEM_MASK + 1);
+                                for(int i = 0; i < AUDIO_SIZE; i++) {
+                                    AUDIO[i] = mem_rd(I + i);
+                                }
+                            }
+                            break;
+                        }
+
+                    /*
+                        SUPER-CHIP: Fx30 - LD HF, Vx
+                        Set I = location of the 8 x 10 sprite for digit Vx.
+                    */
+                    case 0x30:
+                        {
+                            I = BIGFONT_ADR + (V[X] & 0xF) * 10;
+                            break;
+                        }
 
+                    /*
+                        XO-CHIP: Fx3A - PITCH Vx
+                        Set the audio pattern playback pitch = Vx.
+                    */
+                    case 0x3A:
+                        {
+                            if(VARIANT == VARIANT_XOCHIP) {
+                                PITCH = V[X];
+                            }
+                            break;
+                        }
+
+                    /*
+                        SUPER-CHIP: Fx75 - LD R, Vx / Fx85 - LD Vx, R
+                        Store / read V0 through Vx in the flag registers (V0 - V7 on SUPER-CHIP).
+                    */
+                    case 0x75:
+                    case 0x85:
+                        {
+                            int count = std::min<int>(X, VARIANT == VARIANT_SCHIP ? 7 : MAX_FLAGCOUNT - 1);
+                            for(int i = 0; i <= count; i++) {
+                                if(KK == 0x75) {
+                                    FLAGS[i] = V[i];
+                                } else {
+                                    V[i] = FLAGS[i];
+                                }
+                            }
+                            break;
+                        }
+                }
+                break;
+            }
+    }
+}
 
 /*
     Represents EXEC of ONE instruction
@@ -267,9 +1953,17 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0x00E0:
                         {
-                            for(int i=0; i<MAX_DISPSIZE; i++){
-                                DISP[i] = PIX_OFF;
-                            }                             
+                            if(XDISP) {
+                                clear_planes(PLANES);
+                            } else {
+                                for(int i=0; i<MAX_HEIGHT; i++){
+                                    DISP[i] = 0x0;
+                                }
+                                DISP_HASH = 0;
+                            }
+                            if(MTR) {
+                                metrics_inc(MTR->draws);
+                            }
                             break;
                         }                     
                     
@@ -279,8 +1973,19 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0x00EE:
                         {
-                            PC = STACK[SP];
-                            SP--;
+                            /* SP stays in -1 .. 15: popping an empty stack takes the top slot */
+                            fault(FAULT_STACKUNF, SP < 0);
+                            PC = STACK[SP & (MAX_STACKSIZE - 1)];
+                            SP = ((SP + MAX_STACKSIZE) & (MAX_STACKSIZE - 1)) - 1;
+                            break;
+                        }
+
+                    /* SUPER-CHIP / XO-CHIP: 00Cn, 00Dn, 00FB - 00FF */
+                    default:
+                        {
+                            if(XDISP) {
+                                instr_ext(instruction);
+                            }
                             break;
                         }
                 }
@@ -303,7 +2008,9 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     INSTR(4): 2nnn - CALL addr
                     Call subroutine at nnn.
                 */
-                SP++;
+                /* a full stack wraps to the bottom slot */
+                fault(FAULT_STACKOVF, SP == MAX_STACKSIZE - 1);
+                SP = (SP + 1) & (MAX_STACKSIZE - 1);
                 STACK[SP] = PC;
                 PC = NNN;
                 break;
@@ -316,7 +2023,7 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     Skip next instruction if Vx = kk.
                 */
                 if(V[X] == KK) {
-                    PC += 2;
+                    skip();
                 }
                 break;
             }
@@ -328,19 +2035,25 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     Skip next instruction if Vx != kk.
                 */ 
                 if(V[X] != KK) {
-                    PC += 2;
+                    skip();
                 }
                 break;
             }
 
         case 0x5:
             {
+                /* XO-CHIP: 5xy2, 5xy3 */
+                if(N != 0x0 && VARIANT == VARIANT_XOCHIP) {
+                    instr_ext(instruction);
+                    break;
+                }
+
                 /*
                     INSTR(7): 5xy0 - SE Vx, Vy
                     Skip next instruction if Vx = Vy.
                 */
                 if(V[X] == V[Y]) {
-                    PC += 2;
+                    skip();
                 }
                 break;
             }
@@ -489,7 +2202,7 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     Skip next instruction if Vx != Vy.
                 */
                 if(V[X] != V[Y]) {
-                    PC += 2;
+                    skip();
                 }
                 break;
             }
@@ -509,8 +2222,9 @@ int CHIP8::instr_exec(uint16_t instruction) {
                 /*
                     INSTR(21): Bnnn - JP V0, addr
                     Jump to location nnn + V0. 
+                    (SUPER-CHIP: Bxnn, jump to xnn + Vx)
                 */
-                PC = NNN + (uint16_t) V[0];
+                PC = NNN + (uint16_t) V[VARIANT == VARIANT_SCHIP ? X : 0];
                 break;
             }
 
@@ -520,7 +2234,11 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     INSTR(22): Cxkk - RND Vx, byte
                     Set Vx = random byte AND kk. 
                 */
-                V[X] = KK & (uint8_t) (rand() % 0xFF);  /* the RAND number ) */
+                /* xorshift32, the state is part of the machine so snapshots replay the same */
+                RNG ^= RNG << 13;
+                RNG ^= RNG >> 17;
+                RNG ^= RNG << 5;
+                V[X] = KK & (uint8_t) (RNG >> 24);  /* the RAND number ) */
                 break;
             }
 
@@ -530,7 +2248,11 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     INSTR(23): Dxyn - DRW Vx, Vy, nibble
                     Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision. 
                 */
-                
+                if(XDISP) {
+                    draw_ext(X, Y, N);
+                    break;
+                }
+
                 V[0xF] = 0;
                 
                 /* 
@@ -538,29 +2260,36 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     then these same bytes are copied onto starting point V[X], V[Y].
                     a sprite is groups of 8 bytes, where each byte belongs in one row.
                     meaning N byte sprite -> N rows of 8 bytes each.
+
+                    each display row is a 64-bit word, so a sprite row is placed with one rotate
+                    (wrapping around to the opposite side), and XORed / checked for collision at once.
                 */
+                if(DBG_ARMED) {
+                    for(int i = 0; i < N; i++) {
+                        dbg_access(I + i, DBG_WRD);
+                    }
+                }
+                fault(FAULT_MEMOOB, I + N > MEM_MASK + 1);
+                int x = V[X] % MAX_WIDTH;
                 for(int i = 0; i < N; i++) {
-                    // the row-byte of the sprite is MEM[I + i]
-                    for(int j = 0; j < MAX_SPRITEWD; j++) {
-                        // bit-wise check of this byte to determine whether to turn the pixel on.
-                        if( ((0x80 >> j) & MEM[I + i]) != 0) {
-                            //check if pixel is already ON, to set flag.
-                            int index =  ((V[Y]+i)*MAX_WIDTH)  +  (V[X]+j)   ;
-                                  /*     |---DISPLAY ROW #---|    |-BIT #-|             */
-                                  //                              (COLUMN)
-                            if(index > MAX_DISPSIZE) {
-                                index = index % MAX_DISPSIZE;
-                            }
-                            if(DISP[index] == PIX_ON) {
-                                
-                                V[0XF] = 1;
-                            }
-                            // xor the byte against pixel ON
-                            DISP[index] ^= PIX_ON;
-                        } 
+                    // the row-byte of the sprite is MEM[I + i], at the top of the word
+                    uint64_t sprite = (uint64_t) mem_rd(I + i) << (MAX_WIDTH - MAX_SPRITEWD);
+                    // rotate right by x, so bits past the right edge come back in on the left
+                    uint64_t bits   = (sprite >> x) | (x ? sprite << (MAX_WIDTH - x) : 0);
+                    int      y      = (V[Y] + i) % MAX_HEIGHT;
+                    uint64_t *row   = &DISP[y];
+                    //check if any pixel is already ON, to set flag.
+                    if(*row & bits) {
+                        V[0xF] = 1;
                     }
+                    // xor the byte against pixel ON, and fold the change into the frame hash
+                    DISP_HASH ^= word_change(y, *row, *row ^ bits);
+                    *row ^= bits;
                 }
                 set_drawflag(true);
+                if(MTR) {
+                    metrics_inc(MTR->draws);
+                }
                 break;
             }
             
@@ -574,8 +2303,9 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0x9E:
                         {   
-                            if(KEYP[V[X]] == KEY_DOWN) {
-                                PC += 2;
+                            fault(FAULT_KEYOOB, V[X] >= MAX_KEYCOUNT);
+                            if(KEYP[V[X] & (MAX_KEYCOUNT - 1)] == KEY_DOWN) {
+                                skip();
                             }
                             break;
                         }
@@ -586,8 +2316,9 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0xA1:
                         {
-                            if(KEYP[V[X]] == KEY_UP) {
-                                PC += 2;
+                            fault(FAULT_KEYOOB, V[X] >= MAX_KEYCOUNT);
+                            if(KEYP[V[X] & (MAX_KEYCOUNT - 1)] == KEY_UP) {
+                                skip();
                             }
                             break;
                         }
@@ -598,13 +2329,28 @@ int CHIP8::instr_exec(uint16_t instruction) {
         case 0xF:
             {
                 switch(KK) {
+                    /* SUPER-CHIP / XO-CHIP: F000 nnnn, Fn01, F002, Fx30, Fx3A, Fx75, Fx85 */
+                    case 0x00:
+                    case 0x01:
+                    case 0x02:
+                    case 0x30:
+                    case 0x3A:
+                    case 0x75:
+                    case 0x85:
+                        {
+                            if(VARIANT != VARIANT_CHIP8) {
+                                instr_ext(instruction);
+                            }
+                            break;
+                        }
+
                     /*
                         INSTR(26): Fx07 - LD Vx, DT
                         Set Vx = delay timer value.
                     */
                     case 0x07: 
                         {
-                            V[X] = DT;
+                            V[X] = get_DT();
                             break;
                         }
 
@@ -614,13 +2360,18 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0x0A: 
                         {
-                            /* this checks if any key is pressed at the moment, then breaks once found*/
+                            /*
+                                this checks if any key is pressed at the moment.
+                                if none is, the instruction is executed again on the next cycle,
+                                so the frontend (and the debugger) keep running while we wait.
+                            */
                             int key_index = 0;
-                            while(true) {
-                                if(KEYP[key_index] == KEY_DOWN){
-                                    break;
-                                }
-                                key_index = (key_index + 1) % MAX_KEYCOUNT;
+                            while(key_index < MAX_KEYCOUNT && KEYP[key_index] != KEY_DOWN) {
+                                key_index++;
+                            }
+                            if(key_index == MAX_KEYCOUNT) {
+                                PC -= 2;
+                                break;
                             }
                             V[X] = key_index;
                             
@@ -633,7 +2384,7 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0x15:
                         {
-                            DT = V[X];
+                            DT_END = timer_end(V[X]);
                             break;
                         }
 
@@ -643,7 +2394,7 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0x18:
                         {
-                            ST = V[X];
+                            ST_END = timer_end(V[X]);
                             break;
                         }
 
@@ -653,7 +2404,7 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0x1E:
                         {
-                            if(I+V[X] > 0xFFF) {
+                            if(I+V[X] > MEM_MASK) {
                                 V[0xF] = 1;
                             } else V[0xF] = 0;
                             I = (uint16_t) (I + V[X]);
@@ -676,9 +2427,15 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0x33:
                         {  
-                            MEM[I]      = (uint8_t) V[X] / 100; 
-                            MEM[I + 1]  = (uint8_t) ( (V[X] / 10) % 10);   
-                            MEM[I + 2]  = (uint8_t) ( V[X] % 100) % 10;
+                            if(DBG_ARMED) {
+                                for(int i=0 ; i < 3 ; i++){
+                                    dbg_access(I + i, DBG_WWR);
+                                }
+                            }
+                            fault(FAULT_MEMOOB, I + 2 > MEM_MASK);
+                            mem_wr(I,     (uint8_t) V[X] / 100); 
+                            mem_wr(I + 1, (uint8_t) ( (V[X] / 10) % 10));   
+                            mem_wr(I + 2, (uint8_t) ( V[X] % 100) % 10);
                             break;
                         }
 
@@ -688,10 +2445,19 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0x55:
                         {
+                            if(DBG_ARMED) {
+                                for(int i=0 ; i <= X ; i++){
+                                    dbg_access(I + i, DBG_WWR);
+                                }
+                            }
+                            fault(FAULT_MEMOOB, I + X > MEM_MASK);
                             for(int i=0 ; i <= X ; i++){
-                                MEM[I+i] = V[i];
+                                mem_wr(I+i, V[i]);
+                            }
+                            /* SUPER-CHIP leaves I as it is */
+                            if(VARIANT != VARIANT_SCHIP) {
+                                I = (uint16_t) (I + X + 0x1);
                             }
-                            I = (uint16_t) (I + X + 0x1);
                             break;
                         }
 
@@ -701,10 +2467,18 @@ int CHIP8::instr_exec(uint16_t instruction) {
                     */
                     case 0x65:
                         {
+                            if(DBG_ARMED) {
+                                for(int i=0 ; i <= X ; i++){
+                                    dbg_access(I + i, DBG_WRD);
+                                }
+                            }
+                            fault(FAULT_MEMOOB, I + X > MEM_MASK);
                             for(int i=0 ; i <= X ; i++){
-                                V[i] = MEM[I+i];
+                                V[i] = mem_rd(I+i);
+                            }
+                            if(VARIANT != VARIANT_SCHIP) {
+                                I = (uint16_t) (I + X + 0x1);
                             }
-                            I = (uint16_t) (I + X + 0x1);
                             
                             break;
                         }                        
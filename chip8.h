@@ -2,6 +2,10 @@
 #define CHIP8_H
 
 #include<cstdint>   
+#include<cstddef>
+#include<atomic>
+
+struct METRICS;
 
 /*
 
@@ -24,8 +28,20 @@
     Keypad: 8-bit, 16 total
     Font: 16 characters, 5 nibbles per character
 
+    Variants (set_variant), on top of the above:
+        SUPER-CHIP 1.1  : 128 x 64 hi-res display (00FE / 00FF), 16 x 16 sprites (Dxy0),
+                          scrolling (00Cn, 00FB, 00FC), exit (00FD), 8 x 10 font (Fx30),
+                          flag registers (Fx75 / Fx85)
+        XO-CHIP         : SUPER-CHIP, plus 64KB memory (F000 nnnn), 2 bitplanes (Fn01),
+                          scroll up (00Dn), register ranges (5xy2 / 5xy3), audio pattern (F002, Fx3A)
+
 */
 
+/* VARIANTS */
+#define VARIANT_CHIP8   0           /* COSMAC VIP CHIP-8                */
+#define VARIANT_SCHIP   1           /* SUPER-CHIP 1.1                   */
+#define VARIANT_XOCHIP  2           /* XO-CHIP                          */
+
 /* CPU */
 #define MAX_REGCOUNT    16          /* Maximum number of registers      */  
 
@@ -33,6 +49,13 @@
 #define MAX_MEMSIZE     4096        /* Maximum Memory Size              */  
 #define MAX_STACKSIZE   16          /* Maximum Stack Size               */
 #define PC_STARTADR     0x200       /* Program counter start address    */
+#define MAX_ROMSIZE     (MAX_MEMSIZE - PC_STARTADR) /* Maximum ROM Size  */
+#define MEM_PAGESHIFT   8           /* log2 of the page size            */
+#define MEM_PAGESIZE    (1 << MEM_PAGESHIFT)            /* copy-on-write page size  */
+#define MEM_PAGECOUNT   (MAX_MEMSIZE >> MEM_PAGESHIFT)  /* pages in memory          */
+#define XO_MEMSIZE      65536       /* XO-CHIP Memory Size              */
+#define XO_ROMSIZE      (XO_MEMSIZE - PC_STARTADR)      /* XO-CHIP ROM Size         */
+#define MEM_MAXPAGES    (XO_MEMSIZE >> MEM_PAGESHIFT)   /* pages in the largest memory */
 
 /* I/O */
 #define MAX_WIDTH       64          /* Maximum Width of Display (Pixels)    */
@@ -45,6 +68,137 @@
 #define KEY_DOWN        1           /* Key DOWN value                       */
 #define KEY_UP          0           /* Key UP value                         */
 #define MAX_SPRITEWD    8           /* Maximum Sprite Width (Bits)          */
+#define HIRES_WIDTH     128         /* SUPER-CHIP / XO-CHIP display width   */
+#define HIRES_HEIGHT    64          /* SUPER-CHIP / XO-CHIP display height  */
+#define HIRES_DISPSIZE  128 * 64    /* SUPER-CHIP / XO-CHIP display size    */
+#define HIRES_WORDS     (HIRES_WIDTH / 64)  /* words per display row        */
+#define MAX_PLANES      2           /* XO-CHIP bitplanes                    */
+#define BIGFONT_ADR     0x50        /* 8 x 10 font, after the 4 x 5 one     */
+#define MAX_BIGFONTCOUNT 16 * 10    /* 8 x 10 font size                     */
+#define MAX_FLAGCOUNT   16          /* Fx75 / Fx85 flag registers           */
+#define AUDIO_SIZE      16          /* XO-CHIP audio pattern (bytes)        */
+
+/* INPUT */
+#define INPUT_QSIZE     8           /* queued key events per instance (power of 2)          */
+
+/* TIMING */
+#define VIP_CLOCK           1760900     /* COSMAC VIP clock (Hz)                                    */
+#define VIP_CLOCKS_PER_CYCLE 8          /* clocks per 1802 machine cycle                            */
+#define VIP_FRAME_RATE      60          /* display interrupt / timer rate (Hz)                      */
+#define VIP_CYCLES_PER_FRAME (VIP_CLOCK / VIP_CLOCKS_PER_CYCLE / VIP_FRAME_RATE) /* ~3668 machine cycles  */
+#define TIMER_NEVER         UINT64_MAX  /* next_timer_event() return value: no timer running        */
+
+/* COVERAGE */
+#define COV_MAPSIZE     (1 << 13)   /* edge coverage map size (bytes, power of 2)           */
+
+/* IDLE LOOPS (opcode sequences run_frame retires up to the frame end without running them) */
+#define FUSE_WAIT       0x01        /* Fx07; 3x00; 1nnn     : delay timer wait loop             */
+#define FUSE_SPIN       0x02        /* 1nnn to itself       : halt loop                         */
+#define FUSE_KEY        0x04        /* Fx0A, no key down    : key wait loop                     */
+#define FUSE_IDLE       (FUSE_WAIT | FUSE_SPIN | FUSE_KEY)
+#define FUSE_DEFAULT    FUSE_IDLE
+#define FUSE_NONE       0xFF        /* FUSE table: no idle loop at this address                 */
+
+/* DEBUG */
+#define DBG_STOP        1           /* cycle() return value: stopped by a breakpoint or watchpoint  */
+#define DBG_BRK         0           /* PC breakpoint map                                            */
+#define DBG_WWR         1           /* memory write watchpoint map                                  */
+#define DBG_WRD         2           /* memory read watchpoint map                                   */
+#define DBG_MAPCOUNT    3           /* number of debug bitmaps                                      */
+#define DBG_MAPSIZE     (XO_MEMSIZE / 8)    /* one bit per address                                  */
+
+/* FAULTS (sticky, see CHIP8::get_fault): the access is wrapped and the machine runs on */
+#define FAULT_STACKOVF  0x01        /* 2nnn with the stack full         : wraps to the bottom slot  */
+#define FAULT_STACKUNF  0x02        /* 00EE with the stack empty        : pops the top slot         */
+#define FAULT_MEMOOB    0x04        /* I-relative access past the end of memory : wraps to 0        */
+#define FAULT_PCOOB     0x08        /* PC past the end of memory        : cycle() returns -1        */
+#define FAULT_KEYOOB    0x10        /* Ex9E / ExA1 with Vx > 0xF        : tests key Vx & 0xF        */
+
+/* RUN-UNTIL predicates (see CHIP8::run_until) */
+#define UNTIL_PC        1           /* PC reaches VALUE                 : after every instruction   */
+#define UNTIL_INSTRS    2           /* INSTRS reaches VALUE             : after every instruction   */
+#define UNTIL_REG       3           /* V[ARG] changes                   : after every instruction   */
+#define UNTIL_REGEQ     4           /* V[ARG] is VALUE                  : after every instruction   */
+#define UNTIL_MEM       5           /* MEM[ARG] changes                 : after every instruction   */
+#define UNTIL_FRAME     6           /* frame VALUE (CYCLES / VIP_CYCLES_PER_FRAME) : at frame boundaries */
+#define UNTIL_HASH      7           /* frame_hash() is VALUE            : at frame boundaries       */
+#define UNTIL_MAXPREDS  8           /* predicates per run                                           */
+#define UNTIL_EXPIRED   -2          /* run_until return value: frame budget used up                 */
+#define UNTIL_BREAK     -3          /* run_until return value: stopped by a breakpoint or watchpoint */
+
+struct UNTIL_PRED
+{
+    uint8_t     kind;                   /* UNTIL_*                                  */
+    uint16_t    arg;                    /* register / address                       */
+    uint64_t    value;                  /* target value                             */
+};
+
+/*
+
+    The machine as a flat record (save_state / load_state), e.g. to store or diff states.
+    Modes, attachments and pending key events are not part of it.
+    It holds a CHIP-8 (VARIANT_CHIP8) machine: 4KB and the 64 x 32 display.
+    Padding is zeroed by save_state, so records can be compared and diffed byte by byte.
+
+*/
+struct MACHINE_STATE
+{
+    uint8_t     V[MAX_REGCOUNT];
+    uint16_t    PC;
+    uint16_t    I;
+    int8_t      SP;
+    uint8_t     DT;
+    uint8_t     ST;
+    uint8_t     KEYP[MAX_KEYCOUNT];
+    uint16_t    STACK[MAX_STACKSIZE];
+    uint32_t    RNG;
+    uint64_t    CYCLES;
+    uint64_t    INSTRS;
+    uint64_t    NEXT_TICK;
+    uint64_t    DISP[MAX_HEIGHT];
+    uint8_t     MEM[MAX_MEMSIZE];
+};
+
+/*
+
+    A key event, applied before the instruction with index INSTR executes.
+    HOST_NS is when the frontend saw it, for input-to-photon latency.
+
+*/
+struct INPUT_EVENT
+{
+    uint64_t    instr;                  /* instruction count the event applies at   */
+    uint64_t    host_ns : 56;           /* host time the event was received         */
+    uint64_t    key     : 7;            /* key index                                */
+    uint64_t    val     : 1;            /* KEY_DOWN / KEY_UP                        */
+};
+
+/*
+
+    A MEM_PAGESIZE page of memory, shared (read-only) by every instance and
+    ROM image holding a reference, until one of them writes to it (copy-on-write).
+    The reference count is the only copy-on-write state: a page held once is private,
+    so copying an instance never writes to it.
+
+*/
+struct MEM_PAGE
+{
+    std::atomic<uint32_t>   refs;                   /* instances and images holding this page   */
+    uint8_t                 data[MEM_PAGESIZE];
+};
+
+/*
+
+    The power-on memory of a ROM (font + ROM + zeros), as pages.
+    reset() points an instance back at these.
+
+*/
+struct ROM_IMAGE
+{
+    std::atomic<uint32_t>   refs;                   /* instances holding this image             */
+    int                     count;                  /* pages (MEM_PAGECOUNT, or MEM_MAXPAGES for XO-CHIP) */
+    MEM_PAGE               *pages[MEM_MAXPAGES];
+};
 
 /*
 
@@ -54,48 +208,185 @@
 
         Contains CPU and Memory.
 
+        Layout: everything cycle() touches on each instruction is in the first cache line,
+        MEM is a table of copy-on-write pages shared with the ROM image and with copies of the instance,
+        DISP is 1 bit per pixel. A running CHIP-8 instance is well under 1KB plus the pages it wrote to
+        (see footprint()): the 256-entry page table of XO-CHIP is allocated for that variant only.
+
+        The SUPER-CHIP / XO-CHIP variants draw to XDISP instead of DISP: 128 x 64, two words per row,
+        one such display per bitplane, allocated for those variants only. Low resolution there is
+        2 x 2 blocks of it. The CHIP-8 variant keeps the DISP fast path, so it pays one pointer
+        test per Dxyn / 00E0 and a mask from the first cache line per memory access.
+
+        Copies (copy constructor, assignment) are cheap snapshots of the machine: they share every page.
+        The debugger maps, profiling counters and metrics registry stay with the instance,
+        a copy starts without them and assignment leaves them as they were.
+
 */
 class CHIP8 {
     private:
         
         /*
         
-            CPU Data
+            CPU Data (one cache line)
 
         */
+        alignas(64)
         uint8_t     V[MAX_REGCOUNT];        /* 16 x 8-bit register          */
         uint16_t    PC;                     /* 16-bit program counter       */
         uint16_t    I;                      /* 16-bit index register        */
-        uint8_t     ST;                     /* 8-bit sound timer register   */
-        uint8_t     DT;                     /* 8-bit delay timer register   */
+        int8_t      SP;                     /* 8-bit stack pointer          */
+        bool        draw_flag;              /* flag if display update       */
+
+        /*
+
+            Timing Data
+                CYCLES counts the machine cycles the instructions would have taken on a COSMAC VIP,
+                it is kept in every mode; MODE_TIM makes the timers tick from it (60Hz).
+                The delay and sound timers are not counted down: each is kept as the tick it
+                reaches 0 at, on the timer clock (NEXT_TICK with MODE_TIM, a tick every
+                VIP_CYCLES_PER_FRAME, otherwise INSTRS, a tick per instruction), and its value
+                is worked out when it is read. Retiring an instruction never touches them.
+
+        */
+        uint64_t    CYCLES;                 /* machine cycles executed                              */
+        uint64_t    INSTRS;                 /* instructions executed                                */
+        uint64_t    NEXT_TICK;              /* CYCLES value of the next 60Hz timer tick             */
+        uint64_t    DT_END;                 /* timer clock value the delay timer is 0 at            */
+        uint64_t    ST_END;                 /* timer clock value the sound timer is 0 at            */
+
+        /* the timer clock and its tick, a timer's value and the clock value it is 0 at */
+        uint64_t    timer_clock() {
+            return MODE_TIM ? NEXT_TICK : INSTRS;
+        }
+        uint64_t    timer_step() {
+            return MODE_TIM ? VIP_CYCLES_PER_FRAME : 1;
+        }
+        uint8_t     timer_value(uint64_t end) {
+            uint64_t clock = timer_clock();
+            return end > clock ? (end - clock) / timer_step() : 0;
+        }
+        uint64_t    timer_end(uint8_t val) {
+            return timer_clock() + val * timer_step();
+        }
+
+        uint16_t    DBG_ARMED;              /* number of armed breakpoints and watchpoints          */
+        uint8_t     INQ_HEAD;               /* next key event to apply                              */
+        uint8_t     INQ_TAIL;               /* next free key event slot                             */
+        bool        MODE_TIM;
+        bool        MODE_VRB;
+        uint16_t    MEM_MASK;               /* memory size - 1 (4KB, or 64KB for XO-CHIP)           */
+        uint8_t     FAULT;                  /* FAULT_* raised since reset, sticky                   */
+        uint16_t    FAULT_PC;               /* address of the instruction which raised the first one */
+        METRICS    *MTR;                    /* metrics registry to update, NULL if none             */
 
         /*
         
             MEM Data
         
         */
-        uint8_t     MEM[MAX_MEMSIZE];       /* 4KB RAM                                  */
+        MEM_PAGE  **PAGE;                   /* RAM as 256B pages: PAGE_TABLE (4KB), or 256 allocated (64KB, XO-CHIP) */
+        MEM_PAGE   *PAGE_TABLE[MEM_PAGECOUNT];  /* the page table of the 4KB memories     */
+        int         PAGES;                  /* pages in use                             */
+        ROM_IMAGE  *IMAGE;                  /* power-on memory, for reset()             */
         uint16_t    STACK[MAX_STACKSIZE];   /* 16 x 16-bit addresses for function trace */
-        int8_t      SP;                     /* 8-bit stack pointer                      */
+
+        /* memory access, addresses wrap at the memory size (12 bits, 16 bits for XO-CHIP) */
+        uint8_t     mem_rd(uint16_t addr) {
+            addr &= MEM_MASK;
+            return PAGE[addr >> MEM_PAGESHIFT]->data[addr & (MEM_PAGESIZE - 1)];
+        }
+        void        mem_wr(uint16_t addr, uint8_t val) {
+            addr &= MEM_MASK;
+            int p = addr >> MEM_PAGESHIFT;
+            if(PAGE[p]->refs.load(std::memory_order_acquire) != 1) {
+                unshare(p);
+            }
+            PAGE[p]->data[addr & (MEM_PAGESIZE - 1)] = val;
+        }
+        /* raises KIND if HIT, without a branch: the first fault keeps the address of its instruction */
+        void        fault_at(uint8_t kind, bool hit, uint16_t addr) {
+            uint8_t bits = kind & (uint8_t) -(int) hit;
+            FAULT_PC = (FAULT == 0) & (bits != 0) ? addr : FAULT_PC;
+            FAULT   |= bits;
+        }
+        /* the same, from the instruction being executed (PC has moved past it) */
+        void        fault(uint8_t kind, bool hit) {
+            fault_at(kind, hit, PC - 2);
+        }
+        void        unshare(int );          /* gives the instance its own copy of a shared page */
+        void        release_memory();       /* drops the pages and the image                */
+        void        page_table(int );       /* points PAGE at an empty table of that many pages */
+        void        copy_machine(const CHIP8&);
 
         /*
         
             I/O Data
 
         */
-        uint8_t    DISP[MAX_DISPSIZE];     /* 64 x 32 32-bit pixels each   */
-        uint8_t    KEYP[MAX_KEYCOUNT];     /* 16 x 8-bit key pressed       */
-        
-        bool       draw_flag;              /* flag if display update       */
+        uint64_t    DISP[MAX_HEIGHT];       /* 64 x 32 pixels, a row per word, MSB is x = 0 */
+        uint64_t    DISP_HASH;              /* frame_hash(), updated with every display word written */
+        uint8_t     KEYP[MAX_KEYCOUNT];     /* 16 x 8-bit key pressed       */
+
+        /*
+
+            SUPER-CHIP / XO-CHIP Data
+
+        */
+        uint64_t   *XDISP;                  /* planes x 64 rows x 2 words, MSB of the first word is x = 0, NULL for CHIP-8 */
+        uint8_t     VARIANT;                /* VARIANT_*                                */
+        bool        HIRES;                  /* 128 x 64, otherwise 64 x 32 in 2 x 2 blocks */
+        uint8_t     PLANES;                 /* bitplanes drawn to (bit per plane)       */
+        uint8_t     PITCH;                  /* XO-CHIP audio pitch                      */
+        uint8_t     FLAGS[MAX_FLAGCOUNT];   /* Fx75 / Fx85 flag registers               */
+        uint8_t     AUDIO[AUDIO_SIZE];      /* XO-CHIP audio pattern, 1 bit per sample  */
+        int         plane_count();          /* bitplanes of the variant                 */
+        void        skip();                 /* skips the next instruction (F000 nnnn is 4 bytes) */
+        void        skip_long();            /* XO-CHIP part of skip()                   */
+        void        instr_ext(uint16_t );   /* SUPER-CHIP / XO-CHIP instructions        */
+        void        draw_ext(uint8_t , uint8_t , uint8_t );  /* Dxyn on XDISP         */
+        void        scroll(int , int );     /* scrolls the drawn planes (pixels of XDISP) */
+        void        clear_planes(uint8_t ); /* clears the bitplanes in a mask           */
+        void        rehash_display();       /* recomputes DISP_HASH from the display    */
+
+        INPUT_EVENT INQ[INPUT_QSIZE];       /* pending key events, in order             */
+        uint64_t    INPUT_NS;               /* host time of the oldest applied event not yet seen on screen, 0 if none */
+        void        apply_inputs();         /* applies the due key events               */
+
+        /*
+
+            Profiling and Debug Data
+                allocated when turned on.
+                DBG_MAP is only looked at while DBG_ARMED is non-zero, so an idle instance pays
+                a single compare per cycle.
+
+        */
+        uint64_t   *OP_CYCLES;             /* machine cycles spent per leading opcode nibble (16), NULL if OFF */
+        uint8_t    *COV;                   /* edge coverage map (COV_MAPSIZE), NULL if OFF         */
+        uint16_t   COV_PREV;               /* previous PC (hashed), for edge coverage              */
+        uint8_t    *FUSE;                  /* idle loop per address (0: not looked at yet, FUSE_NONE), NULL if OFF */
+        uint8_t    FUSE_MASK;              /* FUSE_* idle loops skipped                            */
+        uint8_t    fuse_classify(uint16_t );       /* finds the idle loop starting at an address   */
+        bool       exec_fused(uint64_t );          /* skips the idle loop at PC, up to a cycle limit */
+        void       retire(uint16_t );              /* accounts an executed instruction (cycles, timers) */
+        void       retire_until(uint16_t , uint64_t );  /* retires an instruction repeatedly, up to a cycle limit */
+        void       retire_many(uint16_t , uint64_t );   /* retires an instruction N times in one step */
+        int        run_to(uint64_t );              /* runs instructions until CYCLES reaches a limit */
+        bool       until_fired(const UNTIL_PRED&); /* checks a cheap run_until predicate */
+        uint8_t    *DBG_MAP;               /* DBG_MAPCOUNT x DBG_MAPSIZE bitmaps (BRK, WWR, WRD)   */
+        int        DBG_REASON;             /* map which caused the last stop, -1 if none           */
+        uint16_t   DBG_ADDR;               /* address which caused the last stop                   */
+        bool       DBG_SKIP;               /* step over a breakpoint at PC after resuming          */
+        void       dbg_access(uint16_t, int);  /* checks a memory access against a watchpoint map */
 
         /*
         
             Misc.
         
         */
-        bool MODE_VRB;
         bool MODE_SND;
         bool MODE_STP;
+        uint32_t RNG;                                   /* xorshift state for Cxkk, part of the machine so copies replay the same */
         uint16_t bit_mask(uint16_t, uint16_t, int);     /* helper function to mask bits, takes the original 2 bytes, a mask, and a right-shift value*/
 
     public:
@@ -106,20 +397,170 @@ class CHIP8 {
         /* Destructor   */
         ~CHIP8();
 
+        /* snapshots, sharing memory pages until either side writes */
+        CHIP8(const CHIP8&);
+        CHIP8& operator=(const CHIP8&);
+
         /* Load the ROM into memory if it exists */
         int load_rom(char*, bool, bool, bool);
 
+        /* back to power-on state with the same ROM, or with another ROM (keeps the modes) */
+        void reset();
+        int  swap_rom(char*);
+
+        /* bytes used by this instance: the object, plus pages and maps it does not share */
+        size_t footprint();
+
+        /*
+            switches to VARIANT_CHIP8, VARIANT_SCHIP or VARIANT_XOCHIP: sizes the memory and the display
+            for it and resets with an empty memory, so it comes before load_rom / swap_rom.
+        */
+        void set_variant(int );
+        int  get_variant();
+
+        /* memory size in bytes (4KB, 64KB for XO-CHIP) */
+        uint32_t get_memsize();
+
         /* getters and setters */
         bool     get_STP();
         uint32_t get_pixel(int );
+        uint64_t get_row(int );
+
+        /*
+            hash of the display (DISP, or XDISP), equal frames hash equal: kept up to date as Dxyn and 00E0
+            change it, so it costs nothing to read. A blank display hashes to 0.
+        */
+        uint64_t frame_hash();
+
+        /*
+            display size: 64 x 32, or 128 x 64 for SUPER-CHIP / XO-CHIP (whatever the resolution,
+            low resolution is drawn in 2 x 2 blocks). get_pixel takes y * width + x and returns the
+            bitplanes set there (bit 0: plane 1, bit 1: plane 2), get_row is the CHIP-8 display only.
+        */
+        int      get_width();
+        int      get_height();
+
+        /* the whole display as get_pixel values, width x height bytes, a word of pixels at a time */
+        void     get_frame(uint8_t*);
+
+        /*
+            hash of the machine (V, I, PC, SP, STACK, DT, ST, MEM, DISP), equal machines hash equal.
+            Pages still shared with the ROM image are skipped, so it is cheap for ROMs writing little memory.
+        */
+        uint64_t state_hash();
+
+        /*
+            the machine as a flat record, and back (same ROM; pages equal to the ROM image are shared again).
+            CHIP-8 variant only.
+        */
+        void     save_state(MACHINE_STATE*);
+        void     load_state(const MACHINE_STATE*);
         bool     get_drawflag();
         uint8_t  get_key(int );
         void     set_key(int , int );
         void     set_drawflag(bool );
 
+        /*
+            queues a key event (key, value, instruction count to apply at, host time in ns).
+            Returns -1 if the queue is full.
+        */
+        int      queue_key(int , int , uint64_t , uint64_t );
+
+        /* host time of the oldest applied key event since the last call (0 if none), and clears it */
+        uint64_t take_input_stamp();
+
+        /* register and memory access, used by the debugger */
+        uint8_t  get_V(int );
+        void     set_V(int , uint8_t );
+        uint16_t get_PC();
+        void     set_PC(uint16_t );
+        uint16_t get_I();
+        void     set_I(uint16_t );
+        int8_t   get_SP();
+        void     set_SP(int8_t );
+        uint8_t  get_DT();
+        void     set_DT(uint8_t );
+        uint8_t  get_ST();
+        void     set_ST(uint8_t );
+        uint16_t get_stack(int );
+        void     set_stack(int , uint16_t );
+        uint8_t  read_mem(uint16_t );
+        void     write_mem(uint16_t , uint8_t );
+
+        /*
+            faults (FAULT_*) raised since reset or clear_fault, and the address of the instruction which
+            raised the first one. Stack and memory accesses are masked to stay in the machine, so a bad
+            ROM runs on (wrapping around) instead of touching the host: runners check these to report it.
+        */
+        uint8_t  get_fault();
+        uint16_t get_fault_pc();
+        void     clear_fault();
+        static const char *fault_name(uint8_t );
+
+        /* breakpoints and watchpoints, takes the debug map (DBG_BRK, DBG_WWR, DBG_WRD), address and on/off */
+        void     set_debugpoint(int , uint16_t , bool );
+        void     clear_debugpoints();
+        int      get_stop_reason();
+        uint16_t get_stop_addr();
+        void     resume();
+        void     step_over();
+
+        /* timing model (VIP machine cycles), and cumulative counters for profiling */
+        void     set_timing(bool );
+        bool     get_timing();
+        uint64_t get_cycles();
+        uint64_t get_instrs();
+        void     set_profiling(bool );
+        uint64_t get_op_cycles(int );
+        static int instr_cost(uint16_t );
+
+        /*
+            idle-loop skipping: FUSE_* loops run_frame retires up to the frame end in one step, 0 to turn OFF.
+            Only used while no debugpoint, coverage map or pending key event needs to see every instruction.
+        */
+        void     set_fusion(uint8_t );
+
+        /* seeds the random number generator used by Cxkk */
+        void     set_seed(uint32_t );
+
+        /* edge coverage map (COV_MAPSIZE bytes of hit counts) updated by cycle(), NULL to turn OFF */
+        void     set_coverage(uint8_t*);
+
+        /* false for opcodes the interpreter does not implement (0nnn, 8xyF, Ex00, ...) in the CHIP-8 variant */
+        static bool instr_valid(uint16_t );
+
+        /* metrics registry updated by cycle() (see metrics.h), NULL to turn OFF */
+        void     set_metrics(METRICS*);
+
         /* takes care of fetching the instruction and sending it to exec unit */
         int cycle();
 
+        /* runs instructions until the frame's machine cycle budget (VIP_CYCLES_PER_FRAME) is spent */
+        int run_frame();
+
+        /*
+            true while the machine waits on Fx0A: the instruction at PC is Fx0A, no key is down
+            and no key event is queued. It then only polls until a key goes down, so
+            wait_frames lets any number of frames of that pass in one step
+            (the same state as running them, with the timing model).
+        */
+        bool key_waiting();
+        void wait_frames(uint64_t );
+
+        /*
+            when the next timer event happens: the CYCLES value at which the first running timer
+            (delay or sound) reaches 0 with the timing model, the INSTRS value without it,
+            TIMER_NEVER if both are 0. Nothing else changes on its own, so a runner with no key
+            event coming can sleep (or wait_frames) straight up to it.
+        */
+        uint64_t next_timer_event();
+
+        /*
+            runs unthrottled until one of COUNT predicates fires, for at most MAX_FRAMES frames.
+            Returns the index of the predicate, UNTIL_EXPIRED, UNTIL_BREAK, or -1 on error.
+        */
+        int run_until(const UNTIL_PRED*, int , uint64_t );
+
         /* decodes the instruction and executes it */
         int instr_exec(uint16_t );
 };
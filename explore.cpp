@@ -0,0 +1,429 @@
+/*
+
+    Breadth-first state-space explorer for CHIP8 ROMs (no SDL).
+
+    Starting from the booted ROM, every state is expanded with each of the EXPLORE_ACTIONS
+    inputs (no key, or one of the 16 keys held for EXPLORE_HOLDFRAMES frames and released
+    for EXPLORE_RELEASEFRAMES frames), level by level, to list the reachable screens of
+    puzzle ROMs or find the inputs leading to a given screen (-s, a frame_hash() value).
+
+    The frontier of a level is expanded by a pool of threads taking states off a shared index.
+    New states are kept if their CHIP8::state_hash() (V, I, PC, STACK, DT, ST, MEM, DISP) is not
+    in a lock-free open addressing hash set yet, which every thread inserts into with a CAS.
+
+    Every kept state is archived as its action, its parent and the bytes of its MACHINE_STATE
+    which differ from the parent's (delta encoded as runs of <skip, length, bytes>), so any
+    state can be rebuilt from the boot state; only the frontier is held as live instances
+    (CHIP8 copies, sharing the memory pages they did not write).
+
+    usage: chip8-explore <rom> [depth] [threads]
+           chip8-explore <rom> -s <screen hash> [depth] [threads]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include "chip8.h"
+
+using namespace std;
+
+#define EXPLORE_SEED            1           /* RNG seed of the booted instance                      */
+#define EXPLORE_DEPTH           6           /* default number of levels                             */
+#define EXPLORE_BOOTFRAMES      60          /* frames run (no keys) before the first state          */
+#define EXPLORE_HOLDFRAMES      4           /* frames a key is held                                 */
+#define EXPLORE_RELEASEFRAMES   4           /* frames run after releasing it                        */
+#define EXPLORE_ACTIONS         (MAX_KEYCOUNT + 1)  /* no key, key 0 - F                            */
+#define EXPLORE_MAXSTATES       (1 << 21)   /* states kept at most (the hash set is twice as large) */
+
+static_assert(sizeof(MACHINE_STATE) < 0x10000, "delta runs use 16-bit offsets");
+
+/* lock-free set of 64-bit hashes (0 is the empty slot) */
+struct STATE_SET
+{
+    atomic<uint64_t>    *slots;
+    uint64_t            mask;
+    atomic<uint64_t>    count;
+};
+
+/* an archived state: the action from its parent, and its delta in the arena of the thread which found it */
+struct STRUCT_NODE
+{
+    uint32_t            parent;
+    uint8_t             action;
+    uint8_t             arena;
+    uint32_t            len;
+    uint64_t            offset;
+};
+
+/* a state of the frontier */
+struct STRUCT_FRONT
+{
+    uint32_t            node;
+    CHIP8               *machine;
+};
+
+/* a new state found by a worker, numbered when the level is merged */
+struct STRUCT_CHILD
+{
+    uint32_t            parent;
+    uint8_t             action;
+    uint32_t            len;
+    uint64_t            offset;
+    CHIP8               *machine;
+};
+
+struct STRUCT_WORKER
+{
+    CHIP8               work;               /* runs the actions, keeps its idle loop table */
+    vector<uint8_t>     arena;              /* deltas of the states this worker found             */
+    vector<STRUCT_CHILD> children;          /* found during the current level                     */
+    uint64_t            expansions;
+};
+
+void    print_usage();
+void    set_init(STATE_SET*, uint64_t);
+int     set_insert(STATE_SET*, uint64_t);
+void    run_action(CHIP8*, int);
+void    encode_delta(const MACHINE_STATE*, const MACHINE_STATE*, vector<uint8_t>&);
+void    apply_delta(MACHINE_STATE*, const uint8_t*, uint32_t);
+void    expand(vector<STRUCT_FRONT>*, atomic<size_t>*, STRUCT_WORKER*, STATE_SET*, STATE_SET*);
+void    print_found(uint32_t, const vector<STRUCT_NODE>&, vector<STRUCT_WORKER*>&, const MACHINE_STATE*, CHIP8*);
+
+int main(int argc, char *argv[]) {
+    if(argc < 2 || argv[1][0] == '-') {
+        print_usage();
+        return 1;
+    }
+
+    int      arg    = 2;
+    bool     search = false;
+    uint64_t target = 0;
+    if(argc > 2 && strcmp(argv[2], "-s") == 0) {
+        if(argc < 4) {
+            print_usage();
+            return 1;
+        }
+        search = true;
+        target = strtoull(argv[3], NULL, 0);
+        arg    = 4;
+    }
+    int depth   = argc > arg ? atoi(argv[arg]) : EXPLORE_DEPTH;
+    int threads = argc > arg + 1 ? atoi(argv[arg + 1]) : (int) thread::hardware_concurrency();
+    if(depth <= 0 || threads <= 0 || threads > 255) {
+        print_usage();
+        return 1;
+    }
+
+    CHIP8 *boot = new CHIP8();
+    if(boot->swap_rom(argv[1]) == -1) {
+        cerr<<std::endl<<"could not open ROM file."<<std::endl;
+        return 1;
+    }
+    boot->set_seed(EXPLORE_SEED);
+    boot->set_timing(true);
+    for(int f = 0; f < EXPLORE_BOOTFRAMES; f++) {
+        boot->run_frame();
+    }
+
+    MACHINE_STATE *root = new MACHINE_STATE;
+    boot->save_state(root);
+
+    STATE_SET *states  = new STATE_SET;
+    STATE_SET *screens = new STATE_SET;
+    set_init(states, 2 * EXPLORE_MAXSTATES);
+    set_init(screens, 2 * EXPLORE_MAXSTATES);
+    set_insert(states, boot->state_hash());
+    set_insert(screens, boot->frame_hash());
+
+    vector<STRUCT_WORKER*> workers;
+    for(int t = 0; t < threads; t++) {
+        STRUCT_WORKER *w = new STRUCT_WORKER();
+        w->work       = *boot;
+        w->work.set_fusion(FUSE_DEFAULT);
+        w->expansions = 0;
+        workers.push_back(w);
+    }
+
+    vector<STRUCT_NODE>  nodes;
+    vector<STRUCT_FRONT> frontier;
+    STRUCT_NODE  root_node  = {0, 0, 0, 0, 0};
+    STRUCT_FRONT root_front = {0, boot};
+    nodes.push_back(root_node);
+    frontier.push_back(root_front);
+
+    cout<<"exploring "<<argv[1]<<" to depth "<<depth<<" on "<<threads<<" threads ("
+        <<EXPLORE_ACTIONS<<" actions per state)..."<<endl;
+    cout<<setw(6)<<"depth"<<setw(12)<<"frontier"<<setw(12)<<"new"<<setw(12)<<"states"<<setw(10)<<"screens"
+        <<setw(14)<<"states/s"<<endl;
+
+    auto     start = chrono::steady_clock::now();
+    int64_t  found = search && boot->frame_hash() == target ? 0 : -1;
+    size_t   peak_frontier = 0;
+    for(int d = 1; d <= depth && !frontier.empty() && found == -1; d++) {
+        auto   level_start = chrono::steady_clock::now();
+        size_t expanded    = frontier.size();
+
+        size_t frontier_bytes = 0;
+        for(size_t f = 0; f < frontier.size(); f++) {
+            frontier_bytes += frontier[f].machine->footprint();
+        }
+        peak_frontier = max(peak_frontier, frontier_bytes);
+
+        atomic<size_t> next(0);
+        vector<thread> pool;
+        for(int t = 0; t < threads; t++) {
+            pool.push_back(thread(expand, &frontier, &next, workers[t], states, screens));
+        }
+        for(int t = 0; t < threads; t++) {
+            pool[t].join();
+        }
+
+        /* number the new states, they are the next frontier */
+        size_t fresh = 0;
+        frontier.clear();
+        for(int t = 0; t < threads; t++) {
+            vector<STRUCT_CHILD>& children = workers[t]->children;
+            for(size_t c = 0; c < children.size(); c++) {
+                STRUCT_NODE  node  = {children[c].parent, children[c].action, (uint8_t) t, children[c].len, children[c].offset};
+                STRUCT_FRONT front = {(uint32_t) nodes.size(), children[c].machine};
+                if(search && found == -1 && children[c].machine->frame_hash() == target) {
+                    found = nodes.size();
+                }
+                nodes.push_back(node);
+                frontier.push_back(front);
+            }
+            fresh += children.size();
+            children.clear();
+        }
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - level_start).count();
+        cout<<setw(6)<<d<<setw(12)<<expanded
+            <<setw(12)<<fresh<<setw(12)<<nodes.size()<<setw(10)<<screens->count.load()
+            <<setw(14)<<(uint64_t) (fresh / max(seconds, 1e-9))<<endl;
+
+        if(states->count.load() >= EXPLORE_MAXSTATES) {
+            cout<<"state limit ("<<EXPLORE_MAXSTATES<<") reached."<<endl;
+            break;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    uint64_t expansions = 0;
+    size_t   delta_bytes = 0;
+    for(int t = 0; t < threads; t++) {
+        expansions  += workers[t]->expansions;
+        delta_bytes += workers[t]->arena.size();
+    }
+    size_t archive_bytes = nodes.size() * sizeof(STRUCT_NODE) + delta_bytes;
+
+    cout<<endl<<"EXPLORE REPORT:"<<endl;
+    cout<<"    states       : "<<nodes.size()<<" ("<<screens->count.load()<<" distinct screens)"<<endl;
+    cout<<"    expansions   : "<<expansions<<" in "<<fixed<<setprecision(2)<<seconds<<"s ("
+        <<(uint64_t) (expansions / max(seconds, 1e-9))<<"/s, "<<(uint64_t) (nodes.size() / max(seconds, 1e-9))<<" new states/s)"<<endl;
+    cout<<"    archive      : "<<archive_bytes<<" bytes, "<<setprecision(1)<<(double) archive_bytes / nodes.size()
+        <<" bytes/state ("<<sizeof(MACHINE_STATE)<<" bytes/state undiffed)"<<endl;
+    cout<<"    frontier     : "<<peak_frontier<<" bytes at most (live instances)"<<endl;
+
+    if(search) {
+        if(found == -1) {
+            cout<<"screen "<<hex<<"0x"<<target<<dec<<" not reached."<<endl;
+        } else {
+            print_found(found, nodes, workers, root, &workers[0]->work);
+        }
+    }
+
+    for(size_t f = 0; f < frontier.size(); f++) {
+        delete frontier[f].machine;
+    }
+    for(int t = 0; t < threads; t++) {
+        delete workers[t];
+    }
+    delete[] states->slots;
+    delete[] screens->slots;
+    delete states;
+    delete screens;
+    delete root;
+
+    return search && found == -1 ? 1 : 0;
+}
+
+void print_usage() {
+    cout<<"usage: chip8-explore <rom> [depth] [threads]"<<endl;
+    cout<<"       chip8-explore <rom> -s <screen hash> [depth] [threads]"<<endl;
+}
+
+/* sets up an empty set of SIZE slots (power of 2) */
+void set_init(STATE_SET *set, uint64_t size) {
+    set->slots = new atomic<uint64_t>[size];
+    for(uint64_t s = 0; s < size; s++) {
+        set->slots[s].store(0, memory_order_relaxed);
+    }
+    set->mask  = size - 1;
+    set->count = 0;
+}
+
+/*
+    Inserts HASH (linear probing, CAS on the empty slot).
+    Returns 1 if it was not in the set, 0 if it was, -1 if the set is full (EXPLORE_MAXSTATES).
+*/
+int set_insert(STATE_SET *set, uint64_t hash) {
+    hash = hash == 0 ? 1 : hash;
+    for(uint64_t s = hash & set->mask; ; s = (s + 1) & set->mask) {
+        uint64_t slot = set->slots[s].load(memory_order_relaxed);
+        if(slot == hash) {
+            return 0;
+        }
+        if(slot == 0) {
+            if(set->count.load(memory_order_relaxed) >= EXPLORE_MAXSTATES) {
+                return -1;
+            }
+            if(set->slots[s].compare_exchange_strong(slot, hash, memory_order_relaxed)) {
+                set->count.fetch_add(1, memory_order_relaxed);
+                return 1;
+            }
+            if(slot == hash) {
+                return 0;
+            }
+        }
+    }
+}
+
+/* ACTION 0: no key, 1 - 16: key ACTION - 1 held, then released */
+void run_action(CHIP8 *c, int action) {
+    if(action > 0) {
+        c->set_key(action - 1, KEY_DOWN);
+    }
+    for(int f = 0; f < EXPLORE_HOLDFRAMES; f++) {
+        c->run_frame();
+    }
+    if(action > 0) {
+        c->set_key(action - 1, KEY_UP);
+    }
+    for(int f = 0; f < EXPLORE_RELEASEFRAMES; f++) {
+        c->run_frame();
+    }
+}
+
+/*
+    Appends the bytes of B which differ from A, as runs of <skip (16 bits), length (16 bits), bytes>.
+    A run only ends at 4 equal bytes, shorter gaps cost less than a new header.
+*/
+void encode_delta(const MACHINE_STATE *a, const MACHINE_STATE *b, vector<uint8_t>& out) {
+    const uint8_t *pa = (const uint8_t*) a;
+    const uint8_t *pb = (const uint8_t*) b;
+    int size = sizeof(MACHINE_STATE);
+    int last = 0;
+    int i    = 0;
+    while(i < size) {
+        /* skip equal words */
+        if(i + 8 <= size && memcmp(pa + i, pb + i, 8) == 0) {
+            i += 8;
+            continue;
+        }
+        if(pa[i] == pb[i]) {
+            i++;
+            continue;
+        }
+        int end = i + 1, same = 0;
+        while(end < size && same < 4) {
+            same = pa[end] == pb[end] ? same + 1 : 0;
+            end++;
+        }
+        end -= same;
+
+        uint16_t header[2] = {(uint16_t) (i - last), (uint16_t) (end - i)};
+        out.insert(out.end(), (uint8_t*) header, (uint8_t*) header + sizeof(header));
+        out.insert(out.end(), pb + i, pb + end);
+        last = i = end;
+    }
+}
+
+/* applies the LEN bytes of a delta from encode_delta to STATE */
+void apply_delta(MACHINE_STATE *state, const uint8_t *delta, uint32_t len) {
+    uint8_t *p   = (uint8_t*) state;
+    int      pos = 0;
+    for(uint32_t d = 0; d < len; ) {
+        uint16_t header[2];
+        memcpy(header, delta + d, sizeof(header));
+        d   += sizeof(header);
+        pos += header[0];
+        memcpy(p + pos, delta + d, header[1]);
+        d   += header[1];
+        pos += header[1];
+    }
+}
+
+/* expands frontier states until there are none left, the frontier instances are freed */
+void expand(vector<STRUCT_FRONT> *frontier, atomic<size_t> *next, STRUCT_WORKER *w, STATE_SET *states, STATE_SET *screens) {
+    MACHINE_STATE *parent = new MACHINE_STATE;
+    MACHINE_STATE *child  = new MACHINE_STATE;
+
+    size_t f;
+    while((f = next->fetch_add(1)) < frontier->size()) {
+        STRUCT_FRONT& front = (*frontier)[f];
+        front.machine->save_state(parent);
+
+        for(int a = 0; a < EXPLORE_ACTIONS; a++) {
+            w->work = *front.machine;
+            run_action(&w->work, a);
+            w->expansions++;
+
+            if(set_insert(states, w->work.state_hash()) != 1) {
+                continue;
+            }
+            set_insert(screens, w->work.frame_hash());
+
+            STRUCT_CHILD c;
+            w->work.save_state(child);
+            c.parent  = front.node;
+            c.action  = a;
+            c.offset  = w->arena.size();
+            encode_delta(parent, child, w->arena);
+            c.len     = w->arena.size() - c.offset;
+            c.machine = new CHIP8(w->work);
+            w->children.push_back(c);
+        }
+        delete front.machine;
+        front.machine = NULL;
+    }
+
+    delete parent;
+    delete child;
+}
+
+/* rebuilds state NODE from the boot state and its deltas, and prints the inputs and the screen */
+void print_found(uint32_t node, const vector<STRUCT_NODE>& nodes, vector<STRUCT_WORKER*>& workers, const MACHINE_STATE *root, CHIP8 *c) {
+    vector<uint32_t> path;
+    for(uint32_t n = node; n != 0; n = nodes[n].parent) {
+        path.push_back(n);
+    }
+
+    MACHINE_STATE *state = new MACHINE_STATE;
+    memcpy(state, root, sizeof(MACHINE_STATE));
+    cout<<"screen found at depth "<<path.size()<<", keys:";
+    for(size_t p = path.size(); p-- > 0; ) {
+        const STRUCT_NODE& n = nodes[path[p]];
+        apply_delta(state, workers[n.arena]->arena.data() + n.offset, n.len);
+        if(n.action == 0) {
+            cout<<" -";
+        } else {
+            cout<<" "<<hex<<uppercase<<n.action - 1<<dec<<nouppercase;
+        }
+    }
+    cout<<endl;
+
+    c->load_state(state);
+    for(int y = 0; y < MAX_HEIGHT; y++) {
+        uint64_t row = c->get_row(y);
+        for(int x = 0; x < MAX_WIDTH; x++) {
+            cout<<((row >> (MAX_WIDTH - 1 - x)) & 0x1 ? '#' : '.');
+        }
+        cout<<endl;
+    }
+    delete state;
+}
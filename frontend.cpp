@@ -0,0 +1,317 @@
+#include "frontend.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <ctime>
+#include <csignal>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+const uint32_t fe_palette[FE_COLORS] = {
+    PIX_OFF_COLOR, PIX_ON_COLOR, PIX_PLANE2_COLOR, PIX_BOTH_COLOR,
+    TILE_BORDER_COLOR, TILE_FOCUS_COLOR, TILE_HALT_COLOR,
+};
+
+#define TERM_LOGROWS        4           /* rows kept under the image for the emulator's messages    */
+#define TERM_DEFAULT_COLS   80          /* size assumed if stdout is not a terminal                 */
+#define TERM_DEFAULT_ROWS   24
+#define TERM_NOCELL         0xFFFF      /* cell never sent                                          */
+
+/* Ctrl-C / kill without a window: the frontends turn it into FE_QUIT, so the emulator shuts down cleanly */
+static volatile sig_atomic_t fe_interrupted = 0;
+
+static void fe_interrupt(int ) {
+    fe_interrupted = 1;
+}
+
+static void fe_catch_signals() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = fe_interrupt;
+    sigaction(SIGINT,  &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
+
+static bool fe_take_interrupt(FE_EVENT *event) {
+    if(!fe_interrupted) {
+        return false;
+    }
+    fe_interrupted = 0;
+    event->type = FE_QUIT;
+    return true;
+}
+
+static uint64_t fe_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+    FRONTEND_NULL: runs headless.
+*/
+class FE_NULL : public FRONTEND {
+    public:
+        int open(int , int , int , int , uint32_t ) {
+            fe_catch_signals();
+            return 0;
+        }
+        bool present(const uint8_t* , bool ) {
+            return false;
+        }
+        bool poll(FE_EVENT *event) {
+            return fe_take_interrupt(event);
+        }
+        void tone(bool ) {
+        }
+};
+
+/*
+    FRONTEND_TERM: the image is drawn at the top of the terminal, which keeps a scrolling region
+    under it for whatever the emulator prints. A cell is 1 x 2 pixels (upper half block, the top
+    pixel in the foreground color and the bottom one in the background color), or 2 x 4 pixels
+    (a braille pattern in the color of its brightest pixel) if half-blocks do not fit.
+    SHOWN holds what every cell shows, so a frame sends only the cells which differ, with a cursor
+    move only where a run of changed cells starts and a color change only where the colors do.
+*/
+class FE_TERM : public FRONTEND {
+    private:
+        int                     width;          /* image size (pixels)                      */
+        int                     height;
+        bool                    braille;        /* 2 x 4 pixels per cell, otherwise 1 x 2   */
+        int                     cols;           /* image size (cells)                       */
+        int                     rows;
+        std::vector<uint16_t>   shown;          /* cell contents sent, TERM_NOCELL if none  */
+        uint32_t                flags;
+        bool                    toning;
+        bool                    raw;            /* stdin switched to raw mode               */
+        struct termios          saved;          /* stdin mode to restore                    */
+        uint64_t                held[256];      /* time (ms) each key goes up, 0 if it is up */
+        std::string             input;          /* bytes read but not parsed yet            */
+        std::string             out;
+
+        void color(uint32_t argb, bool background) {
+            char sgr[32];
+            snprintf(sgr, sizeof(sgr), "\x1b[%d;2;%u;%u;%um", background ? 48 : 38,
+                     (argb >> 16) & 0xFF, (argb >> 8) & 0xFF, argb & 0xFF);
+            out += sgr;
+        }
+
+        /* the contents of cell (CX, CY): two palette entries, or a dot mask and a palette entry */
+        uint16_t cell(const uint8_t *image, int cx, int cy) {
+            if(!braille) {
+                int y = 2 * cy;
+                uint8_t top    = image[y * width + cx];
+                uint8_t bottom = y + 1 < height ? image[(y + 1) * width + cx] : 0;
+                return top << 8 | bottom;
+            }
+            uint8_t mask = 0, entry = 0;
+            for(int dy = 0; dy < 4; dy++) {
+                for(int dx = 0; dx < 2; dx++) {
+                    int x = 2 * cx + dx, y = 4 * cy + dy;
+                    if(x >= width || y >= height || image[y * width + x] == 0) {
+                        continue;
+                    }
+                    /* dots 1-3 and 4-6 run down the columns, 7 and 8 are the bottom row */
+                    mask |= 1 << (dy < 3 ? dy + 3 * dx : 6 + dx);
+                    entry = std::max(entry, image[y * width + x]);
+                }
+            }
+            return mask << 8 | entry;
+        }
+
+        /* takes one key (or escape sequence) from INPUT, -1 if none, 0 if it is not a key */
+        int take_key() {
+            if(input.empty()) {
+                return -1;
+            }
+            unsigned char c = input[0];
+            if(c != FE_KEY_ESCAPE || input.size() == 1 || (input[1] != '[' && input[1] != 'O')) {
+                input.erase(0, 1);
+                if(c == '\n') {
+                    return FE_KEY_ENTER;
+                }
+                return c < 0x80 ? tolower(c) : 0;
+            }
+            /* CSI / SS3 sequence: up to its final byte, F5 is ESC [ 1 5 ~ */
+            size_t end = 2;
+            while(end < input.size() && (input[end] < 0x40 || input[end] > 0x7E)) {
+                end++;
+            }
+            if(end == input.size()) {
+                return -1;
+            }
+            std::string sequence = input.substr(0, end + 1);
+            input.erase(0, end + 1);
+            return sequence == "\x1b[15~" ? FE_KEY_F5 : 0;
+        }
+
+    public:
+        FE_TERM() : width(0), height(0), braille(false), cols(0), rows(0), flags(0), toning(false), raw(false) {
+            memset(held, 0, sizeof(held));
+        }
+
+        ~FE_TERM() {
+            if(rows == 0) {
+                return;
+            }
+            /* back to a plain terminal, with the cursor under whatever was printed */
+            printf("\x1b[0m\x1b[r\x1b[?25h\x1b[999;1H\n");
+            fflush(stdout);
+            if(raw) {
+                tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+            }
+        }
+
+        int open(int image_wd, int image_ht, int , int , uint32_t options) {
+            width  = image_wd;
+            height = image_ht;
+            flags  = options;
+
+            struct winsize size;
+            int term_cols = TERM_DEFAULT_COLS, term_rows = TERM_DEFAULT_ROWS;
+            if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 0) {
+                term_cols = size.ws_col;
+                term_rows = size.ws_row;
+            }
+            braille = width > term_cols || (height + 1) / 2 + TERM_LOGROWS > term_rows;
+            cols    = braille ? (width + 1) / 2 : width;
+            rows    = braille ? (height + 3) / 4 : (height + 1) / 2;
+            shown.assign(cols * rows, TERM_NOCELL);
+
+            /* keys one at a time without echo, Ctrl-C still interrupts */
+            if(isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved) == 0) {
+                struct termios mode = saved;
+                mode.c_lflag    &= ~(ICANON | ECHO);
+                mode.c_iflag    &= ~(ICRNL | IXON);
+                mode.c_cc[VMIN]  = 0;
+                mode.c_cc[VTIME] = 0;
+                raw = tcsetattr(STDIN_FILENO, TCSANOW, &mode) == 0;
+            }
+            fe_catch_signals();
+
+            /* clear, hide the cursor, and scroll the messages under the image */
+            printf("\x1b[2J\x1b[?25l\x1b[%d;%dr\x1b[%d;1H", rows + 1, std::max(term_rows, rows + 1), rows + 1);
+            fflush(stdout);
+            return 0;
+        }
+
+        bool present(const uint8_t *image, bool changed) {
+            if(!changed) {
+                return false;
+            }
+            out = "\x1b" "7";
+            uint32_t fg = 0, bg = 0;
+            bool     colored = false;
+            int      next = -1;                 /* cell the cursor is at, after the last one sent */
+            for(int cy = 0; cy < rows; cy++) {
+                for(int cx = 0; cx < cols; cx++) {
+                    int      index    = cy * cols + cx;
+                    uint16_t contents = cell(image, cx, cy);
+                    if(contents == shown[index]) {
+                        continue;
+                    }
+                    shown[index] = contents;
+                    if(index != next) {
+                        char move[32];
+                        snprintf(move, sizeof(move), "\x1b[%d;%dH", cy + 1, cx + 1);
+                        out += move;
+                    }
+                    uint32_t want_fg = fe_palette[braille ? contents & 0xFF : contents >> 8];
+                    uint32_t want_bg = fe_palette[braille ? 0 : contents & 0xFF];
+                    if(!colored || want_fg != fg) {
+                        color(want_fg, false);
+                    }
+                    if(!colored || want_bg != bg) {
+                        color(want_bg, true);
+                    }
+                    fg = want_fg;
+                    bg = want_bg;
+                    colored = true;
+                    if(braille) {
+                        uint8_t dots = contents >> 8;   /* U+2800 + dots, in UTF-8 */
+                        out += (char) 0xE2;
+                        out += (char) (0xA0 | dots >> 6);
+                        out += (char) (0x80 | (dots & 0x3F));
+                    } else {
+                        out += "\xE2\x96\x80";          /* U+2580 upper half block */
+                    }
+                    next = cx + 1 < cols ? index + 1 : -1;
+                }
+            }
+            if(colored) {
+                out += "\x1b[0m\x1b" "8";
+                fwrite(out.data(), 1, out.size(), stdout);
+                fflush(stdout);
+            }
+            return false;
+        }
+
+        bool poll(FE_EVENT *event) {
+            if(fe_take_interrupt(event)) {
+                return true;
+            }
+            uint64_t now = fe_now_ms();
+            for(int k = 0; k < 256; k++) {
+                if(held[k] != 0 && held[k] <= now) {
+                    held[k]     = 0;
+                    event->type = FE_KEYUP;
+                    event->key  = k;
+                    return true;
+                }
+            }
+            if(raw) {
+                char buf[64];
+                ssize_t len = read(STDIN_FILENO, buf, sizeof(buf));
+                if(len > 0) {
+                    input.append(buf, len);
+                }
+            }
+            int key;
+            while((key = take_key()) != -1) {
+                if(key == 0) {
+                    continue;
+                }
+                /* a key repeating is still held */
+                bool down = held[key] == 0;
+                held[key] = now + FE_TERM_HOLDMS;
+                if(down) {
+                    event->type = FE_KEYDOWN;
+                    event->key  = key;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void tone(bool on) {
+            if(on && !toning && (flags & FE_SOUND)) {
+                fputc('\a', stdout);
+                fflush(stdout);
+            }
+            toning = on;
+        }
+};
+
+int frontend_default() {
+#ifdef CHIP8_SDL
+    return FRONTEND_SDL;
+#else
+    return isatty(STDOUT_FILENO) ? FRONTEND_TERM : FRONTEND_NULL;
+#endif
+}
+
+FRONTEND *frontend_create(int kind) {
+    switch(kind) {
+        case FRONTEND_NULL: return new FE_NULL();
+        case FRONTEND_TERM: return new FE_TERM();
+#ifdef CHIP8_SDL
+        case FRONTEND_SDL:  return frontend_sdl();
+#endif
+    }
+    return NULL;
+}
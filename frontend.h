@@ -0,0 +1,111 @@
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include <cstdint>
+#include <string>
+#include "chip8.h"
+
+/*
+
+    Frontends: where the emulator shows its frames, gets its input and plays its tone.
+    The core (chip8.cpp) knows nothing about them, so it builds and runs without SDL.
+
+        FRONTEND_NULL : nothing is shown or played, no input but Ctrl-C (headless, e.g. a server with -g or -m)
+        FRONTEND_TERM : the terminal, in Unicode half-blocks (or braille if the terminal is too small for them).
+                        Only the cells which changed since the last frame are sent, as ANSI sequences,
+                        so a live instance can be watched over SSH for little bandwidth and CPU.
+                        Terminals do not report key releases: a key is released FE_TERM_HOLDMS after
+                        its last press (or auto-repeat).
+        FRONTEND_SDL  : an SDL2 window (built with SDL=1, see Makefile), with post-processing (postfx.h)
+                        and a square wave tone.
+
+    An image is presented as one byte per pixel, a palette index: 0 - 3 are the bitplanes lit
+    (see CHIP8::get_pixel), then the tile borders of the tiled mode.
+
+*/
+
+#define FRONTEND_NULL       0
+#define FRONTEND_TERM       1
+#define FRONTEND_SDL        2
+
+/* palette entries */
+#define FE_BORDER           4           /* border of a tile                     */
+#define FE_FOCUS            5           /* border of the focused tile           */
+#define FE_HALT             6           /* border of a stopped tile             */
+#define FE_COLORS           7
+
+/* open() options */
+#define FE_PHOSPHOR         0x01        /* phosphor persistence (SDL)           */
+#define FE_SCANLINES        0x02        /* scanlines (SDL)                      */
+#define FE_RESIZABLE        0x04        /* the window can be resized (SDL)      */
+#define FE_SOUND            0x08        /* tone() plays                         */
+
+/* events */
+#define FE_KEYDOWN          1           /* KEY went down                        */
+#define FE_KEYUP            2           /* KEY went up                          */
+#define FE_QUIT             3           /* window closed, or Ctrl-C             */
+#define FE_DROP             4           /* a file (PATH) was dropped on the window */
+#define FE_CLICK            5           /* left click at X, Y (pixels of the image presented) */
+
+/* keys: printable keys are their (lower case) ASCII code, and so are ESCAPE, TAB and ENTER */
+#define FE_KEY_TAB          '\t'
+#define FE_KEY_ENTER        '\r'
+#define FE_KEY_ESCAPE       0x1B
+#define FE_KEY_F5           0x80        /* first key outside ASCII              */
+
+#define FE_TERM_HOLDMS      150         /* terminal: key held this long after its last press (ms) */
+
+/* colors of the palette entries: ARGB */
+#define PIX_ON_COLOR        0xbff9fff5  /* Pixel ON value                       */
+#define PIX_OFF_COLOR       0xbf001e23  /* Pixel OFF value                      */
+#define PIX_PLANE2_COLOR    0xbfff8a3d  /* XO-CHIP pixel in plane 2 only        */
+#define PIX_BOTH_COLOR      0xbf7a7f80  /* XO-CHIP pixel in both planes         */
+#define TILE_BORDER_COLOR   0xff0c1214  /* border of a tile                     */
+#define TILE_FOCUS_COLOR    0xffffb000  /* border of the focused tile           */
+#define TILE_HALT_COLOR     0xff8b1a1a  /* border of a stopped tile             */
+
+extern const uint32_t fe_palette[FE_COLORS];
+
+struct FE_EVENT
+{
+    int         type;                   /* FE_KEYDOWN .. FE_CLICK               */
+    int         key;                    /* FE_KEYDOWN / FE_KEYUP                */
+    int         x;                      /* FE_CLICK                             */
+    int         y;
+    std::string path;                   /* FE_DROP                              */
+};
+
+class FRONTEND {
+    public:
+        virtual ~FRONTEND() {}
+
+        /*
+            opens for WIDTH x HEIGHT images, in a WIN_WD x WIN_HT window if there is one,
+            with the FE_* options. Returns 0 on success, -1 on error.
+        */
+        virtual int  open(int , int , int , int , uint32_t ) = 0;
+
+        /*
+            shows an image (palette entries, WIDTH x HEIGHT as opened). CHANGED is false if it is the
+            same as the last one. Returns true while it is still animating (the phosphor fading),
+            i.e. it wants to be presented again even if the image does not change.
+        */
+        virtual bool present(const uint8_t* , bool ) = 0;
+
+        /* takes the next event, false if there is none. Never blocks */
+        virtual bool poll(FE_EVENT* ) = 0;
+
+        /* tone ON / OFF (while the sound timer runs) */
+        virtual void tone(bool ) = 0;
+};
+
+/* the frontend used when none is asked for: SDL if it is built in, otherwise the terminal if stdout is one */
+int frontend_default();
+
+/* a FRONTEND_* frontend, NULL if it is not built in (SDL) */
+FRONTEND *frontend_create(int );
+
+/* the SDL frontend (frontend_sdl.cpp) */
+FRONTEND *frontend_sdl();
+
+#endif //FRONTEND_H
@@ -0,0 +1,196 @@
+#include "frontend.h"
+#include "postfx.h"
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+
+#include<SDL2/SDL.h>
+
+using namespace std;
+
+#define TONE_RATE           44100       /* samples per second                   */
+#define TONE_HZ             440         /* square wave frequency                */
+#define TONE_VOLUME         3000        /* amplitude, out of 32767              */
+#define TONE_SAMPLES        1024        /* samples per audio callback           */
+
+/*
+    FRONTEND_SDL: an SDL2 window, the image stretched to it (or scaled by postfx), and a square wave.
+    Only the subsystems used are started: video, and audio if the tone is ON.
+*/
+class FE_SDL : public FRONTEND {
+    private:
+        SDL_Window          *window;
+        SDL_Renderer        *renderer;
+        SDL_Texture         *texture;
+        PFX_STATE           *pfx;               /* post-processing state, NULL if OFF   */
+        bool                fading;             /* phosphor still decaying              */
+        int                 width;              /* image size (pixels)                  */
+        int                 height;
+        vector<uint32_t>    argb;               /* image converted to colors            */
+        SDL_AudioDeviceID   audio;              /* 0 if there is no sound               */
+        uint32_t            phase;              /* samples played                       */
+        bool                toning;
+
+        static void square_wave(void *user, Uint8 *stream, int len) {
+            FE_SDL  *sdl     = (FE_SDL*) user;
+            Sint16  *samples = (Sint16*) stream;
+            for(int i = 0; i < len / (int) sizeof(Sint16); i++, sdl->phase++) {
+                samples[i] = (sdl->phase / (TONE_RATE / TONE_HZ / 2)) & 1 ? TONE_VOLUME : -TONE_VOLUME;
+            }
+        }
+
+        /* the FE_KEY_* of an SDL key, -1 if it has none */
+        static int key_of(SDL_Keycode sym) {
+            if(sym >= 0 && sym < 0x80) {
+                return sym;
+            }
+            return sym == SDLK_F5 ? FE_KEY_F5 : -1;
+        }
+
+    public:
+        FE_SDL() : window(NULL), renderer(NULL), texture(NULL), pfx(NULL), fading(false),
+                   width(0), height(0), audio(0), phase(0), toning(false) {
+        }
+
+        ~FE_SDL() {
+            if(audio != 0) {
+                SDL_CloseAudioDevice(audio);
+            }
+            if(texture) {
+                SDL_DestroyTexture(texture);
+            }
+            if(renderer) {
+                SDL_DestroyRenderer(renderer);
+            }
+            if(window) {
+                SDL_DestroyWindow(window);
+            }
+            delete pfx;
+            SDL_Quit();
+        }
+
+        int open(int image_wd, int image_ht, int win_wd, int win_ht, uint32_t flags) {
+            width  = image_wd;
+            height = image_ht;
+            argb.resize(width * height);
+
+            if(SDL_Init(SDL_INIT_VIDEO | (flags & FE_SOUND ? SDL_INIT_AUDIO : 0)) < 0) {
+                cerr << "Error initializing SDL: " << SDL_GetError() << endl;
+                return -1;
+            }
+
+            window = SDL_CreateWindow("CHIP8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, win_wd, win_ht,
+                                      SDL_WINDOW_SHOWN | (flags & FE_RESIZABLE ? SDL_WINDOW_RESIZABLE : 0));
+            if(!window) {
+                cerr << "Error creating window: " << SDL_GetError() << endl;
+                return -1;
+            }
+            renderer = SDL_CreateRenderer(window, -1, 0);
+            if(!renderer) {
+                cerr << "Error creating renderer: " << SDL_GetError() << endl;
+                return -1;
+            }
+
+            /* the logical size is the image, so clicks come in image pixels */
+            SDL_RenderSetLogicalSize(renderer, width, height);
+
+            /*
+                with post-processing ON, the texture is the scaled output of postfx,
+                otherwise it is the plain image which SDL stretches.
+            */
+            if(flags & (FE_PHOSPHOR | FE_SCANLINES)) {
+                pfx = new PFX_STATE;
+                pfx_init(pfx, width, height, PIX_ON_COLOR, PIX_OFF_COLOR, flags & FE_PHOSPHOR, flags & FE_SCANLINES);
+                texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, PFX_WIDTH, PFX_HEIGHT);
+            } else {
+                texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+            }
+            if(texture == NULL) {
+                cerr << "Error in setting up texture " << SDL_GetError() << endl;
+                return -1;
+            }
+
+            /* no sound device is not an error, the game plays silent */
+            if(flags & FE_SOUND) {
+                SDL_AudioSpec want;
+                memset(&want, 0, sizeof(want));
+                want.freq     = TONE_RATE;
+                want.format   = AUDIO_S16SYS;
+                want.channels = 1;
+                want.samples  = TONE_SAMPLES;
+                want.callback = square_wave;
+                want.userdata = this;
+                audio = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+            }
+            return 0;
+        }
+
+        bool present(const uint8_t *image, bool changed) {
+            if(pfx != NULL && (changed || fading)) {
+                void *texels;
+                int   pitch;
+                if(SDL_LockTexture(texture, NULL, &texels, &pitch) == 0) {
+                    fading = pfx_apply(pfx, image, (uint32_t*) texels, pitch);
+                    SDL_UnlockTexture(texture);
+                }
+            } else if(changed) {
+                for(int i = 0; i < width * height; i++) {
+                    argb[i] = fe_palette[image[i]];
+                }
+                SDL_UpdateTexture(texture, NULL, argb.data(), width * sizeof(uint32_t));
+            }
+
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+            SDL_RenderPresent(renderer);
+            return fading;
+        }
+
+        bool poll(FE_EVENT *event) {
+            SDL_Event sdl_event;
+            while(SDL_PollEvent(&sdl_event)) {
+                switch(sdl_event.type) {
+                    case SDL_QUIT:
+                        event->type = FE_QUIT;
+                        return true;
+
+                    case SDL_KEYDOWN:
+                    case SDL_KEYUP:
+                        event->type = sdl_event.type == SDL_KEYDOWN ? FE_KEYDOWN : FE_KEYUP;
+                        event->key  = key_of(sdl_event.key.keysym.sym);
+                        if(event->key != -1) {
+                            return true;
+                        }
+                        break;
+
+                    case SDL_DROPFILE:
+                        event->type = FE_DROP;
+                        event->path = sdl_event.drop.file;
+                        SDL_free(sdl_event.drop.file);
+                        return true;
+
+                    case SDL_MOUSEBUTTONDOWN:
+                        if(sdl_event.button.button == SDL_BUTTON_LEFT) {
+                            event->type = FE_CLICK;
+                            event->x    = sdl_event.button.x;
+                            event->y    = sdl_event.button.y;
+                            return true;
+                        }
+                        break;
+                }
+            }
+            return false;
+        }
+
+        void tone(bool on) {
+            if(audio != 0 && on != toning) {
+                SDL_PauseAudioDevice(audio, on ? 0 : 1);
+            }
+            toning = on;
+        }
+};
+
+FRONTEND *frontend_sdl() {
+    return new FE_SDL();
+}
@@ -0,0 +1,426 @@
+/*
+
+    Coverage-guided input fuzzer for CHIP8 ROMs (no SDL).
+
+    Drives CHIP8 instances with mutated key sequences, and uses the edge coverage
+    counted by CHIP8::cycle() (set_coverage) as feedback, to find ROM bugs:
+
+        invalid     : an opcode the interpreter does not implement (CHIP8::instr_valid)
+        stack-ovf   : 2nnn with all MAX_STACKSIZE entries in use
+        stack-unf   : 00EE with an empty stack
+        mem-oob     : Dxyn / Fx33 / Fx55 / Fx65 reaching past MAX_MEMSIZE from I
+        pc-oob      : PC running off the end of MEM
+
+    Every instruction is checked BEFORE it is executed, so the machine state is never corrupted.
+
+    Executions fork from snapshots (CHIP8 copies share the memory pages, copy-on-write),
+    so a new input only runs a few key steps on top of an interesting state instead of
+    replaying from boot. An execution which hits new edges becomes a snapshot of its own.
+
+    Each worker thread loads its own ROM image and keeps its own corpus, so the refcounted
+    pages are never touched by two cores; only the virgin (seen) coverage map, the
+    statistics and the crash list are shared.
+
+    Every crash is written as crash-<kind>-<pc>.keys: one key mask (hex, bit n = key n) per
+    FUZZ_STEPINSTRS instructions from boot, which replays it with -r.
+
+    usage: chip8-fuzz <rom> [seconds] [threads]
+           chip8-fuzz <rom> -r <crash file>
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include "chip8.h"
+
+using namespace std;
+
+#define FUZZ_SEED       0xC8C8C8C8  /* RNG seed of the booted instance (replays must match)  */
+#define FUZZ_STEPINSTRS 64          /* instructions run per key step                        */
+#define FUZZ_MAXSTEPS   4           /* key steps appended per execution (1 - 4)             */
+#define FUZZ_BOOTSTEPS  4           /* key steps (no keys) run before the first snapshot    */
+#define FUZZ_CORPUSMAX  4096        /* snapshots kept per worker                            */
+#define FUZZ_SECONDS    10          /* default run time                                     */
+
+enum CRASHKIND {CRASH_NONE, CRASH_INVALID, CRASH_STACKOVF, CRASH_STACKUNF, CRASH_MEMOOB, CRASH_PCOOB};
+const char *crash_names[] = {"none", "invalid", "stack-ovf", "stack-unf", "mem-oob", "pc-oob"};
+
+/* an interesting state, and the key masks (one per step) which lead to it from boot */
+struct STRUCT_ENTRY
+{
+    CHIP8               snap;
+    vector<uint16_t>    path;
+};
+
+/* state shared by the workers */
+struct STRUCT_SHARED
+{
+    atomic<uint8_t>     virgin[COV_MAPSIZE];    /* coverage buckets seen by any worker  */
+    atomic<uint64_t>    execs;
+    atomic<uint64_t>    paths;
+    atomic<uint64_t>    crashes;
+    atomic<bool>        stop;
+    mutex               crash_lock;
+    set<uint32_t>       crash_seen;             /* (kind << 16) | PC                    */
+};
+
+void    print_usage();
+int     boot_rom(CHIP8*, char*);
+int     check_instr(CHIP8*);
+int     run_step(CHIP8*, uint16_t);
+bool    merge_coverage(uint8_t*, uint8_t*, STRUCT_SHARED*);
+void    save_crash(STRUCT_SHARED*, int, uint16_t, const vector<uint16_t>&);
+void    run_worker(char*, int, STRUCT_SHARED*);
+int     replay(char*, char*);
+
+/* hit count -> bucket (1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+), as in AFL */
+uint8_t count_class[256];
+
+int main(int argc, char *argv[]) {
+    if(argc < 2 || argv[1][0] == '-') {
+        print_usage();
+        return 1;
+    }
+
+    if(argc > 2 && strcmp(argv[2], "-r") == 0) {
+        if(argc < 4) {
+            print_usage();
+            return 1;
+        }
+        return replay(argv[1], argv[3]);
+    }
+
+    int seconds = argc > 2 ? atoi(argv[2]) : FUZZ_SECONDS;
+    int threads = argc > 3 ? atoi(argv[3]) : (int) thread::hardware_concurrency();
+    if(seconds <= 0 || threads <= 0) {
+        print_usage();
+        return 1;
+    }
+
+    CHIP8 probe;
+    if(boot_rom(&probe, argv[1]) == -1) {
+        cerr<<std::endl<<"could not open ROM file."<<std::endl;
+        return 1;
+    }
+
+    for(int i = 0; i < 256; i++) {
+        count_class[i] = i == 0 ? 0 : i == 1 ? 1 : i == 2 ? 2 : i == 3 ? 4 : i < 8 ? 8 :
+                         i < 16 ? 16 : i < 32 ? 32 : i < 128 ? 64 : 128;
+    }
+
+    STRUCT_SHARED *shared = new STRUCT_SHARED();
+    for(int i = 0; i < COV_MAPSIZE; i++) {
+        shared->virgin[i].store(0, memory_order_relaxed);
+    }
+    shared->execs   = 0;
+    shared->paths   = 0;
+    shared->crashes = 0;
+    shared->stop    = false;
+
+    cout<<"fuzzing "<<argv[1]<<" for "<<seconds<<"s on "<<threads<<" threads..."<<endl;
+
+    vector<thread> workers;
+    for(int i = 0; i < threads; i++) {
+        workers.push_back(thread(run_worker, argv[1], i, shared));
+    }
+
+    auto     start      = chrono::steady_clock::now();
+    uint64_t last_execs = 0;
+    for(int s = 1; s <= seconds; s++) {
+        this_thread::sleep_until(start + chrono::seconds(s));
+        uint64_t execs = shared->execs.load(memory_order_relaxed);
+        cout<<"["<<s<<"s] execs: "<<execs<<"  execs/s: "<<(execs - last_execs)
+            <<"  paths: "<<shared->paths.load(memory_order_relaxed)
+            <<"  crashes: "<<shared->crashes.load(memory_order_relaxed)<<endl;
+        last_execs = execs;
+    }
+    shared->stop = true;
+    for(size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout<<"total execs: "<<shared->execs.load()<<" ("<<(uint64_t) (shared->execs.load() / elapsed)<<"/s)"
+        <<", paths: "<<shared->paths.load()<<", unique crashes: "<<shared->crashes.load()<<endl;
+
+    delete shared;
+    return 0;
+}
+
+void print_usage() {
+    cout<<"usage: chip8-fuzz <rom> [seconds] [threads]"<<endl;
+    cout<<"       chip8-fuzz <rom> -r <crash file>"<<endl<<endl;
+    cout<<"fuzzes the ROM with key sequences for SECONDS (default "<<FUZZ_SECONDS<<") on THREADS (default: all cores),"<<endl;
+    cout<<"crashes are written to crash-<kind>-<pc>.keys, -r replays one."<<endl;
+}
+
+/*
+    Loads the ROM into C, and seeds it so runs from boot are reproducible.
+    Returns 0 on success, -1 if the ROM could not be loaded.
+*/
+int boot_rom(CHIP8 *c, char *path) {
+    if(c->swap_rom(path) == -1) {
+        return -1;
+    }
+    c->set_seed(FUZZ_SEED);
+    return 0;
+}
+
+/*
+    Checks the instruction at PC before it is executed.
+    Returns the CRASHKIND it would trigger, CRASH_NONE if it is safe.
+*/
+int check_instr(CHIP8 *c) {
+    uint16_t pc = c->get_PC();
+    if(pc > MAX_MEMSIZE - 2) {
+        return CRASH_PCOOB;
+    }
+
+    uint16_t instruction = (c->read_mem(pc) << 8) | c->read_mem(pc + 1);
+    if(!CHIP8::instr_valid(instruction)) {
+        return CRASH_INVALID;
+    }
+
+    uint32_t I = c->get_I();
+    uint8_t  X = (instruction & 0x0F00) >> 8;
+    switch(instruction >> 12) {
+        case 0x0:
+            if(instruction == 0x00EE && c->get_SP() < 0) {
+                return CRASH_STACKUNF;
+            }
+            break;
+        case 0x2:
+            if(c->get_SP() >= MAX_STACKSIZE - 1) {
+                return CRASH_STACKOVF;
+            }
+            break;
+        case 0xD:
+            if(I + (instruction & 0x000F) > MAX_MEMSIZE) {
+                return CRASH_MEMOOB;
+            }
+            break;
+        case 0xF:
+            switch(instruction & 0x00FF) {
+                case 0x33:
+                    if(I + 3 > MAX_MEMSIZE) {
+                        return CRASH_MEMOOB;
+                    }
+                    break;
+                case 0x55:
+                case 0x65:
+                    if(I + X + 1 > MAX_MEMSIZE) {
+                        return CRASH_MEMOOB;
+                    }
+                    break;
+            }
+            break;
+    }
+    return CRASH_NONE;
+}
+
+/*
+    Holds down the keys in MASK and runs FUZZ_STEPINSTRS instructions.
+    Returns the CRASHKIND which stopped the step early, CRASH_NONE if it ran through.
+*/
+int run_step(CHIP8 *c, uint16_t mask) {
+    for(int k = 0; k < MAX_KEYCOUNT; k++) {
+        c->set_key(k, (mask >> k) & 0x1);
+    }
+    for(int i = 0; i < FUZZ_STEPINSTRS; i++) {
+        int crash = check_instr(c);
+        if(crash != CRASH_NONE) {
+            return crash;
+        }
+        c->cycle();
+    }
+    return CRASH_NONE;
+}
+
+/*
+    Buckets the hit counts of one execution, merges them into the worker's virgin map and
+    the new ones into the shared map, and clears MAP for the next execution (one pass).
+    Returns true if some bucket was new to the worker.
+*/
+bool merge_coverage(uint8_t *map, uint8_t *local, STRUCT_SHARED *shared) {
+    bool fresh  = false;
+    bool global = false;
+    uint64_t *words = (uint64_t*) map;
+    uint64_t *seen  = (uint64_t*) local;
+
+    for(int i = 0; i < COV_MAPSIZE / 8; i++) {
+        if(words[i] == 0) {
+            continue;
+        }
+        uint8_t *hits = &map[i * 8];
+        for(int j = 0; j < 8; j++) {
+            hits[j] = count_class[hits[j]];
+        }
+        if((words[i] & ~seen[i]) != 0) {
+            seen[i] |= words[i];
+            fresh = true;
+            for(int j = 0; j < 8; j++) {
+                if(hits[j] && (hits[j] & ~shared->virgin[i * 8 + j].fetch_or(hits[j], memory_order_relaxed))) {
+                    global = true;
+                }
+            }
+        }
+        words[i] = 0;
+    }
+    if(global) {
+        shared->paths.fetch_add(1, memory_order_relaxed);
+    }
+    return fresh;
+}
+
+/* Records a crash, and writes its reproducer the first time (KIND, PC) is seen */
+void save_crash(STRUCT_SHARED *shared, int kind, uint16_t pc, const vector<uint16_t>& path) {
+    lock_guard<mutex> guard(shared->crash_lock);
+    if(!shared->crash_seen.insert((kind << 16) | pc).second) {
+        return;
+    }
+    shared->crashes.fetch_add(1, memory_order_relaxed);
+
+    char name[64];
+    snprintf(name, sizeof(name), "crash-%s-%03x.keys", crash_names[kind], pc);
+    ofstream out(name);
+    for(size_t i = 0; i < path.size(); i++) {
+        char line[8];
+        snprintf(line, sizeof(line), "%04x", path[i]);
+        out<<line<<"\n";
+    }
+    cout<<"crash: "<<crash_names[kind]<<" at PC 0x"<<hex<<pc<<dec<<" after "<<path.size()<<" steps -> "<<name<<endl;
+}
+
+/*
+    Fuzzing loop of one worker:
+    picks a snapshot, appends 1 - FUZZ_MAXSTEPS mutated key steps, runs them on a copy,
+    and keeps the result as a snapshot if it hit new coverage.
+*/
+void run_worker(char *path, int id, STRUCT_SHARED *shared) {
+    uint8_t *map   = new uint8_t[COV_MAPSIZE]();
+    uint8_t *local = new uint8_t[COV_MAPSIZE]();
+    uint64_t rng   = 0x9E3779B97F4A7C15ULL * (id + 1);
+    vector<STRUCT_ENTRY*> corpus;
+
+    STRUCT_ENTRY *root = new STRUCT_ENTRY();
+    if(boot_rom(&root->snap, path) == -1) {
+        delete root;
+        delete[] map;
+        delete[] local;
+        return;
+    }
+    for(int i = 0; i < FUZZ_BOOTSTEPS; i++) {
+        root->path.push_back(0);
+        int crash = run_step(&root->snap, 0);
+        if(crash != CRASH_NONE) {
+            save_crash(shared, crash, root->snap.get_PC(), root->path);
+            break;
+        }
+    }
+    corpus.push_back(root);
+
+    CHIP8    run;
+    uint16_t steps[FUZZ_MAXSTEPS];
+    uint64_t execs = 0;
+
+    while(!shared->stop.load(memory_order_relaxed)) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+
+        STRUCT_ENTRY *parent = corpus[rng % corpus.size()];
+        uint16_t      last   = parent->path.empty() ? 0 : parent->path.back();
+        int           count  = 1 + (rng >> 16) % FUZZ_MAXSTEPS;
+        uint64_t      bits   = rng >> 24;
+
+        /* mostly no key or a single key, sometimes two, sometimes keep the last ones held */
+        for(int s = 0; s < count; s++, bits >>= 10) {
+            switch(bits & 0x3) {
+                case 0: steps[s] = 0; break;
+                case 1:
+                case 2: steps[s] = 1 << ((bits >> 2) & 0xF); break;
+                case 3: steps[s] = (bits & 0x200) ? last : (1 << ((bits >> 2) & 0xF)) | (1 << ((bits >> 6) & 0xF)); break;
+            }
+            last = steps[s];
+        }
+
+        run = parent->snap;
+        run.set_coverage(map);
+
+        int crash = CRASH_NONE;
+        int s     = 0;
+        for(; s < count && crash == CRASH_NONE; s++) {
+            crash = run_step(&run, steps[s]);
+        }
+        run.set_coverage(NULL);
+
+        if(++execs % 256 == 0) {
+            shared->execs.fetch_add(256, memory_order_relaxed);
+        }
+
+        bool fresh = merge_coverage(map, local, shared);
+        if(crash != CRASH_NONE) {
+            vector<uint16_t> trail(parent->path);
+            trail.insert(trail.end(), steps, steps + s);
+            save_crash(shared, crash, run.get_PC(), trail);
+            continue;
+        }
+
+        if(fresh && corpus.size() < FUZZ_CORPUSMAX) {
+            STRUCT_ENTRY *entry = new STRUCT_ENTRY();
+            entry->snap = run;
+            entry->path = parent->path;
+            entry->path.insert(entry->path.end(), steps, steps + count);
+            corpus.push_back(entry);
+        }
+    }
+    shared->execs.fetch_add(execs % 256, memory_order_relaxed);
+
+    for(size_t i = 0; i < corpus.size(); i++) {
+        delete corpus[i];
+    }
+    delete[] map;
+    delete[] local;
+}
+
+/*
+    Runs the key masks in FILE from boot, and reports where the ROM crashes.
+    Returns 0 if it crashed as recorded, 1 if it ran through.
+*/
+int replay(char *rom, char *file) {
+    CHIP8 c;
+    if(boot_rom(&c, rom) == -1) {
+        cerr<<std::endl<<"could not open ROM file."<<std::endl;
+        return 1;
+    }
+    ifstream in(file);
+    if(!in.is_open()) {
+        cerr<<"could not open "<<file<<std::endl;
+        return 1;
+    }
+
+    string line;
+    int    step = 0;
+    while(getline(in, line)) {
+        uint16_t mask  = (uint16_t) strtoul(line.c_str(), NULL, 16);
+        int      crash = run_step(&c, mask);
+        if(crash != CRASH_NONE) {
+            cout<<crash_names[crash]<<" at PC 0x"<<hex<<c.get_PC()<<" (instruction 0x"
+                <<((c.read_mem(c.get_PC()) << 8) | c.read_mem(c.get_PC() + 1))<<dec<<") in step "<<step
+                <<", I = 0x"<<hex<<c.get_I()<<", SP = "<<dec<<(int) c.get_SP()<<endl;
+            return 0;
+        }
+        step++;
+    }
+    cout<<"no crash after "<<step<<" steps."<<endl;
+    return 1;
+}
@@ -0,0 +1,586 @@
+/*
+
+    The GDB remote serial protocol stub.
+
+    References: 1. https://sourceware.org/gdb/current/onlinedocs/gdb.html/Packets.html
+                2. https://sourceware.org/gdb/current/onlinedocs/gdb.html/Stop-Reply-Packets.html
+
+*/
+
+#include "gdbstub.h"
+#include <iostream>
+#include <cstdio>
+#include <cerrno>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+static const char HEX[] = "0123456789abcdef";
+
+/* target description, so the debugger knows the register layout above */
+static const char TARGET_XML[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<feature name=\"org.chip8.core\">"
+    "<reg name=\"v0\" bitsize=\"8\" type=\"uint8\" regnum=\"0\"/>"
+    "<reg name=\"v1\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v2\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v3\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v4\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v5\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v6\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v7\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v8\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v9\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"va\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"vb\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"vc\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"vd\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"ve\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"vf\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"i\" bitsize=\"16\" type=\"data_ptr\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "<reg name=\"sp\" bitsize=\"8\" type=\"int8\"/>"
+    "<reg name=\"dt\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"st\" bitsize=\"8\" type=\"uint8\"/>"
+    "</feature>"
+    "</target>";
+
+/*
+    helper functions to convert between hex text and values.
+*/
+static int hex_digit(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static void put_hex8(std::string& out, uint8_t val) {
+    out += HEX[val >> 4];
+    out += HEX[val & 0xF];
+}
+
+static uint8_t get_hex8(const char* p) {
+    return (uint8_t) ((hex_digit(p[0]) << 4) | hex_digit(p[1]));
+}
+
+GDBSTUB::GDBSTUB() {
+    listen_fd = -1;
+    client_fd = -1;
+    halted    = false;
+    history   = NULL;
+}
+
+GDBSTUB::~GDBSTUB() {
+    close_client();
+    if(listen_fd != -1) {
+        close(listen_fd);
+    }
+}
+
+/*
+    Opens a non-blocking listening socket on 127.0.0.1:PORT.
+    Returns 0 on success, -1 on error.
+*/
+int GDBSTUB::open(int port) {
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listen_fd == -1) {
+        std::cerr << "gdb: could not create socket." << std::endl;
+        return -1;
+    }
+
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in addr;
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(bind(listen_fd, (sockaddr*) &addr, sizeof(addr)) == -1 || listen(listen_fd, 1) == -1) {
+        std::cerr << "gdb: could not listen on port " << port << "." << std::endl;
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+
+    std::cout << "gdb: listening on localhost:" << port << "." << std::endl;
+    return 0;
+}
+
+/*
+    Accepts a waiting debugger, if any. The instance halts as soon as one attaches.
+*/
+void GDBSTUB::accept_client() {
+    int fd = accept(listen_fd, NULL, NULL);
+    if(fd == -1) {
+        return;
+    }
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    client_fd = fd;
+    halted    = true;
+    inbuf.clear();
+    std::cout << "gdb: debugger attached, instance halted." << std::endl;
+}
+
+/*
+    Drops the debugger, the instance keeps running.
+*/
+void GDBSTUB::close_client() {
+    if(client_fd != -1) {
+        close(client_fd);
+        client_fd = -1;
+        std::cout << "gdb: debugger detached." << std::endl;
+    }
+    halted = false;
+}
+
+/*
+    Frames DATA as $data#checksum and sends it.
+*/
+void GDBSTUB::send_packet(const std::string& data) {
+    if(client_fd == -1) {
+        return;
+    }
+    uint8_t sum = 0;
+    for(size_t i = 0; i < data.size(); i++) {
+        sum += (uint8_t) data[i];
+    }
+    std::string packet = "$" + data + "#";
+    put_hex8(packet, sum);
+
+    size_t sent = 0;
+    while(sent < packet.size()) {
+        ssize_t n = send(client_fd, packet.data() + sent, packet.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) {
+            if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                continue;
+            }
+            close_client();
+            return;
+        }
+        sent += n;
+    }
+}
+
+void GDBSTUB::set_history(REWIND *rewind) {
+    history = rewind;
+}
+
+bool GDBSTUB::is_halted() {
+    return halted;
+}
+
+/*
+    Called by the game loop when cycle() returns DBG_STOP.
+*/
+void GDBSTUB::stopped(CHIP8 *chip8_instance) {
+    if(client_fd == -1) {
+        /* nobody to report to, carry on */
+        chip8_instance->resume();
+        return;
+    }
+    halted = true;
+    send_packet(stop_reply(chip8_instance));
+}
+
+/*
+    Builds the stop reply for the last stop, reporting the watchpoint address if one was hit.
+*/
+std::string GDBSTUB::stop_reply(CHIP8 *chip8_instance) {
+    std::string reply = "T05";
+    char addr[16];
+    snprintf(addr, sizeof(addr), "%x;", chip8_instance->get_stop_addr());
+
+    switch(chip8_instance->get_stop_reason()) {
+        case DBG_WWR: reply += "watch:";  reply += addr; break;
+        case DBG_WRD: reply += "rwatch:"; reply += addr; break;
+        default: break;
+    }
+    return reply;
+}
+
+/*
+    Builds the reply to a move through the history (REWIND return value STATUS).
+*/
+std::string GDBSTUB::history_reply(CHIP8 *chip8_instance, int status) {
+    switch(status) {
+        case -1:            return "E01";
+        case REWIND_BEGIN:  return "T05replaylog:begin;";
+        case REWIND_END:    return "T05replaylog:end;";
+        default:            return stop_reply(chip8_instance);
+    }
+}
+
+/*
+    Memory as seen by the debugger: MEM, then STACK at GDB_STACKBASE.
+*/
+uint8_t GDBSTUB::read_byte(CHIP8 *chip8_instance, uint32_t addr) {
+    if(addr < chip8_instance->get_memsize()) {
+        return chip8_instance->read_mem(addr);
+    }
+    if(addr >= GDB_STACKBASE && addr < GDB_STACKBASE + MAX_STACKSIZE * 2) {
+        uint16_t entry = chip8_instance->get_stack((addr - GDB_STACKBASE) / 2);
+        return (addr & 1) ? entry >> 8 : entry & 0xFF;
+    }
+    return 0x0;
+}
+
+void GDBSTUB::write_byte(CHIP8 *chip8_instance, uint32_t addr, uint8_t val) {
+    if(addr < chip8_instance->get_memsize()) {
+        chip8_instance->write_mem(addr, val);
+    } else if(addr >= GDB_STACKBASE && addr < GDB_STACKBASE + MAX_STACKSIZE * 2) {
+        int      index = (addr - GDB_STACKBASE) / 2;
+        uint16_t entry = chip8_instance->get_stack(index);
+        if(addr & 1) {
+            entry = (entry & 0x00FF) | (val << 8);
+        } else {
+            entry = (entry & 0xFF00) | val;
+        }
+        chip8_instance->set_stack(index, entry);
+    }
+}
+
+/*
+    Register N in target byte order (little-endian).
+*/
+std::string GDBSTUB::read_register(CHIP8 *chip8_instance, int n) {
+    std::string out;
+    if(n < MAX_REGCOUNT) {
+        put_hex8(out, chip8_instance->get_V(n));
+    } else if(n == 16 || n == 17) {
+        uint16_t val = (n == 16) ? chip8_instance->get_I() : chip8_instance->get_PC();
+        put_hex8(out, val & 0xFF);
+        put_hex8(out, val >> 8);
+    } else if(n == 18) {
+        put_hex8(out, (uint8_t) chip8_instance->get_SP());
+    } else if(n == 19) {
+        put_hex8(out, chip8_instance->get_DT());
+    } else if(n == 20) {
+        put_hex8(out, chip8_instance->get_ST());
+    }
+    return out;
+}
+
+std::string GDBSTUB::read_registers(CHIP8 *chip8_instance) {
+    std::string out;
+    for(int n = 0; n < GDB_REGCOUNT; n++) {
+        out += read_register(chip8_instance, n);
+    }
+    return out;
+}
+
+/*
+    Sets register N from hex text HEX (little-endian).
+*/
+void GDBSTUB::write_register(CHIP8 *chip8_instance, int n, const char* hex) {
+    if(n < MAX_REGCOUNT) {
+        chip8_instance->set_V(n, get_hex8(hex));
+    } else if(n == 16 || n == 17) {
+        uint16_t val = get_hex8(hex) | (get_hex8(hex + 2) << 8);
+        if(n == 16) {
+            chip8_instance->set_I(val);
+        } else {
+            chip8_instance->set_PC(val);
+        }
+    } else if(n == 18) {
+        chip8_instance->set_SP((int8_t) get_hex8(hex));
+    } else if(n == 19) {
+        chip8_instance->set_DT(get_hex8(hex));
+    } else if(n == 20) {
+        chip8_instance->set_ST(get_hex8(hex));
+    }
+}
+
+/*
+    Handles Z<type>,<addr>,<kind> and z<type>,<addr>,<kind>.
+    For watchpoints, KIND is the length of the watched range.
+*/
+void GDBSTUB::set_point(CHIP8 *chip8_instance, const std::string& args, bool on) {
+    unsigned type = 0, addr = 0, kind = 0;
+    if(sscanf(args.c_str(), "%x,%x,%x", &type, &addr, &kind) != 3) {
+        send_packet("E01");
+        return;
+    }
+
+    switch(type) {
+        case 0:
+        case 1:
+            chip8_instance->set_debugpoint(DBG_BRK, addr, on);
+            break;
+        case 2:
+        case 3:
+        case 4:
+            for(unsigned i = 0; i < kind; i++) {
+                if(type != 3) chip8_instance->set_debugpoint(DBG_WWR, addr + i, on);
+                if(type != 2) chip8_instance->set_debugpoint(DBG_WRD, addr + i, on);
+            }
+            break;
+        default:
+            send_packet("");
+            return;
+    }
+    send_packet("OK");
+}
+
+/*
+    Handles a single packet (without the framing).
+*/
+void GDBSTUB::handle_packet(CHIP8 *chip8_instance, const std::string& packet) {
+    if(packet.empty()) {
+        send_packet("");
+        return;
+    }
+
+    const char *args = packet.c_str() + 1;
+
+    switch(packet[0]) {
+        case '?':
+            send_packet("S05");
+            break;
+
+        case 'g':
+            send_packet(read_registers(chip8_instance));
+            break;
+
+        case 'G':
+            {
+                for(int n = 0, off = 0; n < GDB_REGCOUNT && off < (int) strlen(args); n++) {
+                    write_register(chip8_instance, n, args + off);
+                    off += (n == 16 || n == 17) ? 4 : 2;
+                }
+                if(history) {
+                    history->cut(chip8_instance);
+                }
+                send_packet("OK");
+                break;
+            }
+
+        case 'p':
+            send_packet(read_register(chip8_instance, strtol(args, NULL, 16)));
+            break;
+
+        case 'P':
+            {
+                const char *eq = strchr(args, '=');
+                if(eq == NULL) {
+                    send_packet("E01");
+                    break;
+                }
+                write_register(chip8_instance, strtol(args, NULL, 16), eq + 1);
+                if(history) {
+                    history->cut(chip8_instance);
+                }
+                send_packet("OK");
+                break;
+            }
+
+        case 'm':
+            {
+                unsigned addr = 0, len = 0;
+                if(sscanf(args, "%x,%x", &addr, &len) != 2) {
+                    send_packet("E01");
+                    break;
+                }
+                std::string out;
+                for(unsigned i = 0; i < len && out.size() < GDB_BUFSIZE; i++) {
+                    put_hex8(out, read_byte(chip8_instance, addr + i));
+                }
+                send_packet(out);
+                break;
+            }
+
+        case 'M':
+            {
+                unsigned addr = 0, len = 0;
+                const char *data = strchr(args, ':');
+                if(sscanf(args, "%x,%x", &addr, &len) != 2 || data == NULL) {
+                    send_packet("E01");
+                    break;
+                }
+                data++;
+                for(unsigned i = 0; i < len && data[2 * i] && data[2 * i + 1]; i++) {
+                    write_byte(chip8_instance, addr + i, get_hex8(data + 2 * i));
+                }
+                if(history) {
+                    history->cut(chip8_instance);
+                }
+                send_packet("OK");
+                break;
+            }
+
+        case 'c':
+            /* back in time: replay the history, stopping at its end at the latest */
+            if(history && history->in_past(chip8_instance)) {
+                send_packet(history_reply(chip8_instance, history->continue_forward(chip8_instance)));
+                break;
+            }
+            /* no reply until the next stop */
+            chip8_instance->resume();
+            halted = false;
+            break;
+
+        case 's':
+            {
+                if(history && history->in_past(chip8_instance)) {
+                    send_packet(history_reply(chip8_instance, history->step(chip8_instance)));
+                    break;
+                }
+                chip8_instance->resume();
+                if(chip8_instance->cycle() == -1) {
+                    send_packet("S04");
+                } else {
+                    if(history) {
+                        history->record(chip8_instance);
+                    }
+                    send_packet(stop_reply(chip8_instance));
+                }
+                break;
+            }
+
+        case 'b':
+            if(history && packet == "bs") {
+                send_packet(history_reply(chip8_instance, history->step_back(chip8_instance)));
+            } else if(history && packet == "bc") {
+                send_packet(history_reply(chip8_instance, history->continue_back(chip8_instance)));
+            } else {
+                send_packet("");
+            }
+            break;
+
+        case 'Z':
+        case 'z':
+            set_point(chip8_instance, args, packet[0] == 'Z');
+            break;
+
+        case 'D':
+        case 'k':
+            /* leave the instance running, it was here before us */
+            chip8_instance->clear_debugpoints();
+            chip8_instance->resume();
+            send_packet("OK");
+            close_client();
+            break;
+
+        case 'H':
+            send_packet("OK");
+            break;
+
+        case 'q':
+            {
+                if(packet.compare(0, 10, "qSupported") == 0) {
+                    char size[16];
+                    snprintf(size, sizeof(size), "%x", GDB_BUFSIZE);
+                    send_packet(std::string("PacketSize=") + size + ";qXfer:features:read+" +
+                                (history ? ";ReverseStep+;ReverseContinue+" : ""));
+                } else if(packet == "qAttached") {
+                    send_packet("1");
+                } else if(packet == "qC") {
+                    send_packet("QC1");
+                } else if(packet == "qfThreadInfo") {
+                    send_packet("m1");
+                } else if(packet == "qsThreadInfo") {
+                    send_packet("l");
+                } else if(packet.compare(0, 31, "qXfer:features:read:target.xml") == 0) {
+                    unsigned off = 0, len = 0;
+                    sscanf(packet.c_str() + 31, ":%x,%x", &off, &len);
+                    size_t size = sizeof(TARGET_XML) - 1;
+                    if(off >= size) {
+                        send_packet("l");
+                    } else {
+                        std::string chunk(TARGET_XML + off, std::min<size_t>(len, size - off));
+                        send_packet((off + chunk.size() >= size ? "l" : "m") + chunk);
+                    }
+                } else {
+                    send_packet("");
+                }
+                break;
+            }
+
+        default:
+            /* unsupported packets get an empty reply */
+            send_packet("");
+            break;
+    }
+}
+
+/*
+    Accepts a debugger if one is waiting, then processes whatever it has sent.
+    Never blocks.
+*/
+void GDBSTUB::poll(CHIP8 *chip8_instance) {
+    if(listen_fd == -1) {
+        return;
+    }
+    if(client_fd == -1) {
+        accept_client();
+        if(client_fd == -1) {
+            return;
+        }
+    }
+
+    char buf[GDB_BUFSIZE];
+    ssize_t n = recv(client_fd, buf, sizeof(buf), 0);
+    if(n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        chip8_instance->clear_debugpoints();
+        chip8_instance->resume();
+        close_client();
+        return;
+    }
+    if(n > 0) {
+        inbuf.append(buf, n);
+    }
+
+    while(!inbuf.empty()) {
+        char c = inbuf[0];
+
+        /* acks */
+        if(c == '+' || c == '-') {
+            inbuf.erase(0, 1);
+            continue;
+        }
+
+        /* ctrl-c from the debugger */
+        if(c == 0x03) {
+            inbuf.erase(0, 1);
+            halted = true;
+            send_packet("S02");
+            continue;
+        }
+
+        if(c != '$') {
+            inbuf.erase(0, 1);
+            continue;
+        }
+
+        /* wait for the full $data#xx */
+        size_t end = inbuf.find('#');
+        if(end == std::string::npos || end + 2 >= inbuf.size()) {
+            break;
+        }
+        std::string packet = inbuf.substr(1, end - 1);
+        inbuf.erase(0, end + 3);
+
+        if(send(client_fd, "+", 1, MSG_NOSIGNAL) != 1) {
+            close_client();
+            return;
+        }
+        handle_packet(chip8_instance, packet);
+        if(client_fd == -1) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+#include <cstdint>
+#include <string>
+#include "chip8.h"
+#include "rewind.h"
+
+/*
+
+    GDB remote serial protocol (RSP) stub for a CHIP8 instance.
+
+    References: 1. https://sourceware.org/gdb/current/onlinedocs/gdb.html/Remote-Protocol.html
+
+    Listens on a local TCP port, and is polled from the game loop (never blocks it).
+    A connecting debugger halts the instance, detaching lets it run on.
+
+    Registers (in 'g' packet order, little-endian):
+        0  - 15 : V0 - VF   (8-bit)
+        16      : I         (16-bit)
+        17      : PC        (16-bit)
+        18      : SP        (8-bit)
+        19      : DT        (8-bit)
+        20      : ST        (8-bit)
+
+    Memory:
+        0x00000 - 0x00FFF   : MEM (to 0x0FFFF for XO-CHIP)
+        0x10000 - 0x1001F   : STACK, 16 x 16-bit entries (GDB_STACKBASE)
+
+    Supports: Z0/Z1 (PC breakpoints), Z2/Z3/Z4 (write/read/access watchpoints), c, s, D, k,
+              and bs / bc (reverse-step / reverse-continue) with an execution history (see rewind.h).
+              Back in time, s and c replay the history, and stop at its end ("replaylog:end").
+
+*/
+
+#define GDB_PORT        1234        /* default TCP port the stub listens on     */
+#define GDB_STACKBASE   0x10000     /* address STACK is mapped at               */
+#define GDB_REGCOUNT    21          /* number of registers exposed              */
+#define GDB_BUFSIZE     4096        /* maximum packet size                      */
+
+class GDBSTUB {
+    private:
+        int         listen_fd;          /* socket accepting a debugger              */
+        int         client_fd;          /* connected debugger, -1 if none           */
+        bool        halted;             /* instance is stopped by the debugger      */
+        std::string inbuf;              /* bytes received but not yet processed     */
+        REWIND     *history;            /* execution history, NULL if none          */
+
+        void        accept_client();
+        void        close_client();
+        void        send_packet(const std::string& );
+        void        handle_packet(CHIP8*, const std::string& );
+        std::string read_registers(CHIP8*);
+        std::string read_register(CHIP8*, int );
+        void        write_register(CHIP8*, int , const char* );
+        uint8_t     read_byte(CHIP8*, uint32_t );
+        void        write_byte(CHIP8*, uint32_t , uint8_t );
+        std::string stop_reply(CHIP8*);
+        std::string history_reply(CHIP8*, int );
+        void        set_point(CHIP8*, const std::string& , bool );
+
+    public:
+        GDBSTUB();
+        ~GDBSTUB();
+
+        /* Opens the listening socket on PORT (localhost only). Returns 0 on success, -1 on error */
+        int  open(int );
+
+        /* execution history for reverse execution, recorded by the game loop (NULL for none) */
+        void set_history(REWIND*);
+
+        /* Accepts a debugger and processes pending packets, never blocks */
+        void poll(CHIP8*);
+
+        /* true while the debugger holds the instance stopped */
+        bool is_halted();
+
+        /* reports a DBG_STOP returned by CHIP8::cycle() to the debugger and halts */
+        void stopped(CHIP8*);
+};
+
+#endif //GDBSTUB_H
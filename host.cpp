@@ -0,0 +1,157 @@
+/*
+
+    Hosted sessions load test (no SDL): many interactive instances on a few threads.
+
+    Opens SESSIONS instances of the ROMs given (round robin) on the coroutine scheduler (scheduler.h)
+    and plays them in real time for SECONDS. A share of them (HOST_ACTIVE) get a player, who presses
+    a random key for HOST_HOLDMS every HOST_KEYPERIODMS or so; the others never get a key, like
+    sessions left open on a title screen. Then prints what the scheduler ran and the CPU time it took.
+
+    usage: chip8-host <sessions> <seconds> [-t threads] <rom> [<rom> ...]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <sys/resource.h>
+#include "chip8.h"
+#include "scheduler.h"
+
+using namespace std;
+
+#define HOST_ACTIVE         0.1         /* share of the sessions with a player                      */
+#define HOST_KEYPERIODMS    1500        /* mean time between two key presses of a player (ms)       */
+#define HOST_HOLDMS         100         /* time a key is held (ms)                                  */
+#define HOST_TICKMS         5           /* player thread period (ms)                                */
+
+/* a player: the key it holds, and when it next presses / releases */
+struct STRUCT_PLAYER
+{
+    SESSION     *session;
+    int         key;                    /* key held, -1 if none                     */
+    uint64_t    next;                   /* host time (ns) of the next key event     */
+};
+
+atomic<uint64_t> presented(0);         /* frames with something drawn              */
+
+void        count_frame(SESSION*, void*);
+double      cpu_seconds();
+void        print_usage();
+
+int main(int argc, char *argv[]) {
+    if(argc < 4) {
+        print_usage();
+        return 1;
+    }
+    int count   = atoi(argv[1]);
+    int seconds = atoi(argv[2]);
+    int threads = SCHED_THREADS;
+    int arg     = 3;
+    if(strcmp(argv[arg], "-t") == 0 && argc > arg + 2) {
+        threads = atoi(argv[arg + 1]);
+        arg    += 2;
+    }
+    if(count <= 0 || seconds <= 0 || threads <= 0) {
+        print_usage();
+        return 1;
+    }
+
+    /* one booted image per ROM, every session is a copy sharing its pages */
+    vector<CHIP8*> roms;
+    for(int i = arg; i < argc; i++) {
+        CHIP8 *c = new CHIP8();
+        if(c->swap_rom(argv[i]) == -1) {
+            cerr<<"could not open ROM file "<<argv[i]<<", skipped."<<endl;
+            delete c;
+            continue;
+        }
+        roms.push_back(c);
+    }
+    if(roms.empty()) {
+        return 1;
+    }
+
+    double  cpu_start  = cpu_seconds();
+    auto    wall_start = chrono::steady_clock::now();
+
+    SCHEDULER *sched = new SCHEDULER(threads);
+    vector<STRUCT_PLAYER> players;
+    srand(1);
+    for(int i = 0; i < count; i++) {
+        CHIP8 *machine = new CHIP8(*roms[i % roms.size()]);
+        machine->set_seed(i + 1);
+        SESSION *session = sched->open(machine, count_frame, NULL);
+        if(i < count * HOST_ACTIVE) {
+            players.push_back({session, -1, sched_now() + (uint64_t) (rand() % HOST_KEYPERIODMS) * 1000000});
+        }
+    }
+    cout<<"hosting "<<count<<" sessions of "<<roms.size()<<" ROMs ("<<players.size()<<" played) on "
+        <<threads<<" threads for "<<seconds<<"s..."<<endl;
+
+    /* the players */
+    uint64_t end = sched_now() + (uint64_t) seconds * 1000000000;
+    while(sched_now() < end) {
+        uint64_t now = sched_now();
+        for(size_t p = 0; p < players.size(); p++) {
+            STRUCT_PLAYER *player = &players[p];
+            if(now < player->next) {
+                continue;
+            }
+            if(player->key == -1) {
+                player->key  = rand() % MAX_KEYCOUNT;
+                player->next = now + HOST_HOLDMS * 1000000ULL;
+                sched->post_key(player->session, player->key, KEY_DOWN);
+            } else {
+                sched->post_key(player->session, player->key, KEY_UP);
+                player->key  = -1;
+                player->next = now + (uint64_t) (rand() % (2 * HOST_KEYPERIODMS)) * 1000000;
+            }
+        }
+        this_thread::sleep_for(chrono::milliseconds(HOST_TICKMS));
+    }
+
+    SCHED_STATS stats;
+    sched->get_stats(&stats);
+    delete sched;
+
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - wall_start).count();
+    double cpu  = cpu_seconds() - cpu_start;
+
+    cout<<fixed<<setprecision(1);
+    cout<<"frames run      "<<stats.frames<<" ("<<stats.frames / wall<<"/s, "<<stats.dropped<<" dropped late)"<<endl;
+    cout<<"frames drawn    "<<presented<<endl;
+    cout<<"frames waited   "<<stats.waited<<" (on Fx0A, in one step)"<<endl;
+    cout<<"resumes         "<<stats.resumes<<endl;
+    cout<<"on a key wait   "<<stats.waiting<<" sessions at the end"<<endl;
+    cout<<"CPU time        "<<cpu<<"s over "<<wall<<"s ("<<100 * cpu / wall<<"% of a core, "
+        <<setprecision(2)<<1e6 * cpu / max<uint64_t>(stats.frames, 1)<<"us a frame)"<<endl;
+
+    for(size_t r = 0; r < roms.size(); r++) {
+        delete roms[r];
+    }
+    return 0;
+}
+
+/* what a real host would hand the frame to its encoder for */
+void count_frame(SESSION *session, void *user) {
+    (void) user;
+    if(session->machine->get_drawflag()) {
+        session->machine->set_drawflag(false);
+        presented++;
+    }
+}
+
+double cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+void print_usage() {
+    cout<<"usage: chip8-host <sessions> <seconds> [-t threads] <rom> [<rom> ...]"<<endl;
+}
@@ -3,31 +3,52 @@
     Author: Rohan Shenoy
 
     The main driver program for the chip8 emulator
-    Manages the Display, and running the game loop.
+    Manages the Display (through a frontend, see frontend.h), and running the game loop.
 */
 
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <vector>
+#include <time.h>
 #include <unistd.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "chip8.h"
-
-#include<SDL2/SDL.h>
+#include "gdbstub.h"
+#include "rewind.h"
+#include "metrics.h"
+#include "frontend.h"
 
 using namespace std;
 
-#define MODE_VRB        000000001
-#define MODE_SND        000000010
-#define MODE_STP        000000100
-#define PIX_ON_COLOR    0xbff9fff5    /* Pixel ON color value: ARGB                    */
-#define PIX_OFF_COLOR   0xbf001e23    /* Pixel OFF color value: ARGB                   */
+#define MODE_VRB        0x00000001
+#define MODE_SND        0x00000002
+#define MODE_STP        0x00000004
+#define MODE_GDB        0x00000008
+#define MODE_TIM        0x00000010
+#define MODE_PFX        0x00000020
+#define MODE_SCN        0x00000040
+#define MODE_WCH        0x00000080
+#define MODE_MTR        0x00000100
+#define MODE_UNT        0x00000200
+#define MODE_RUN        0x00000400
+#define MODE_RUNTHR     0x00000800
+#define MODE_NUL        0x00001000
+#define MODE_TRM        0x00002000
+#define UNTIL_MAXFRAMES 216000        /* run-until budget: one hour of 60Hz frames      */
 #define REFRESH_TIME    1300          /* Refresh time in milliseconds                  */
 
 /* State of the machine, will be used for trace, and running. */
 enum MACHINESTATE {EMU_ON, EMU_RUN, EMU_STOP, EMU_OFF, EMU_UNDEF};
 MACHINESTATE STATE = EMU_OFF; 
 
-/* SDL2 paramters, window width and height. */
+/* window width and height (SDL frontend). */
 #define WIN_WD 960
 #define WIN_HT 480
 uint8_t keymap[16] = {
@@ -38,39 +59,157 @@ uint8_t keymap[16] = {
             7   8   9   E                           A   S   D   F
             A   0   B   F                           Z   X   C   V               
 */
-    SDLK_x, SDLK_1, SDLK_2, SDLK_3,
-    SDLK_q, SDLK_w, SDLK_e, SDLK_a,
-    SDLK_s, SDLK_d, SDLK_z, SDLK_c,
-    SDLK_4, SDLK_r, SDLK_f, SDLK_v,
+    'x', '1', '2', '3',
+    'q', 'w', 'e', 'a',
+    's', 'd', 'z', 'c',
+    '4', 'r', 'f', 'v',
+};
+
+/* keyboard (FE_KEY_*) to keypad lookup, filled from keymap by setup_keypad(). -1 if not mapped */
+#define KEYPAD_LUTSIZE  128
+int8_t keypad_lut[KEYPAD_LUTSIZE];
+
+/* input-to-photon latency samples (microseconds) */
+#define LATENCY_SAMPLES 4096
+struct STRUCT_LATENCY
+{
+    uint32_t    samples[LATENCY_SAMPLES];   /* ring of the last samples     */
+    uint64_t    count;                      /* samples recorded             */
 };
 
-struct STRUCT_SDL
+struct STRUCT_VIEW
 {
-    SDL_Window* window;
-    SDL_Renderer* renderer;
-    SDL_Texture *texture;
+    FRONTEND    *frontend;
+    bool        fading;             /* frontend still animating (phosphor)  */
+    bool        sound;              /* tone while the sound timer runs      */
+    uint64_t    last_hash;          /* frame_hash() of the frame last presented */
 };
 
+/* frontend the instance is shown on (-n null, -T terminal), -1 for frontend_default() */
+int frontend_kind = -1;
+
+/*
+    Variant the ROMs run as (-S SUPER-CHIP, -x XO-CHIP), -1 to go by the file extension:
+    .sc8 is SUPER-CHIP, .xo8 XO-CHIP, anything else CHIP-8.
+*/
+int rom_variant = -1;
+
+/*
+    Run-ahead (-r / -R): after every real frame, a copy of the machine is run
+    FRAMES more frames with the input held as it is, and that future frame is
+    presented instead; the copy is then dropped. Games which react to a key a
+    frame or more late show it that much earlier.
+*/
+#define RUNAHEAD_FRAMES 1             /* frames emulated ahead, if no count is given   */
+#define RUNAHEAD_MAX    9             /* most frames emulated ahead                    */
+int runahead_frames = 0;
+
+/* reverse execution (-g): instructions between two keyframes of the history, set with -k<N> */
+uint64_t rewind_interval = REWIND_INTERVAL;
+
+struct STRUCT_RUNAHEAD
+{
+    int                     frames;     /* frames emulated ahead, 0 if OFF              */
+    bool                    threaded;   /* speculation runs on the worker thread        */
+    CHIP8                   ahead;      /* speculative copy, presented instead          */
+    thread                  worker;
+    mutex                   lock;
+    condition_variable      wake;
+    bool                    pending;    /* a snapshot waits to be run ahead             */
+    bool                    quit;       /* worker has to exit                           */
+};
+
+/* inotify watch on the ROM file, reloads it when it is rebuilt. */
+struct STRUCT_WATCH
+{
+    int     fd;                     /* inotify instance, -1 if OFF          */
+    string  dir;                    /* directory of the ROM (watched)       */
+    string  name;                   /* file name of the ROM                 */
+};
+
+/*
+    Tiled mode (-tile): many instances side by side in one window.
+    All tiles live in one atlas (TILE_WD x TILE_HT each, with a 1 pixel border),
+    which is uploaded once and drawn with a single copy per refresh.
+*/
+#define TILE_WD             (MAX_WIDTH  + 2)    /* tile width in the atlas (pixels)     */
+#define TILE_HT             (MAX_HEIGHT + 2)    /* tile height in the atlas (pixels)    */
+#define TILE_SCALE          4                   /* window pixels per atlas pixel (max)  */
+#define TILE_MAXCOUNT       256                 /* maximum number of instances          */
+
+struct STRUCT_TILES
+{
+    FRONTEND        *frontend;
+    vector<CHIP8*>  instances;
+    vector<bool>    halted;                 /* stopped after an error               */
+    vector<uint64_t> shown;                 /* frame_hash() of the frame in the tile */
+    vector<uint8_t> faults;                 /* FAULT_* kinds already reported       */
+    int             cols;
+    int             rows;
+    int             focus;                  /* instance receiving the keyboard      */
+    uint8_t         *atlas;                 /* the atlas, cols x rows tiles (palette entries, see frontend.h) */
+};
 
-void    parse_commands(int, char*[], uint8_t*);
-int     setup_rom(CHIP8*, char*, uint8_t);
-int     setup_window(struct STRUCT_SDL*);
-int     run_gameloop(CHIP8*, struct STRUCT_SDL*, int );
-void    close_window(struct STRUCT_SDL*);
+void    print_usage();
+void    parse_commands(int, char*[], uint32_t*);
+int     setup_rom(CHIP8*, char*, uint32_t);
+int     setup_view(struct STRUCT_VIEW*, CHIP8*, uint32_t);
+int     variant_of(char*);
+int     setup_watch(struct STRUCT_WATCH*, char*, uint32_t);
+bool    poll_watch(struct STRUCT_WATCH*);
+int     run_gameloop(CHIP8*, struct STRUCT_VIEW*, int, GDBSTUB*, REWIND*, struct STRUCT_WATCH*, METRICS*, struct STRUCT_LATENCY*, struct STRUCT_RUNAHEAD*);
+void    setup_runahead(struct STRUCT_RUNAHEAD*, uint32_t);
+void    start_runahead(struct STRUCT_RUNAHEAD*, CHIP8*);
+CHIP8*  finish_runahead(struct STRUCT_RUNAHEAD*);
+void    runahead_worker(struct STRUCT_RUNAHEAD*);
+void    close_runahead(struct STRUCT_RUNAHEAD*);
+bool    present_frame(CHIP8*, struct STRUCT_VIEW*);
+void    setup_keypad();
+int     keypad_index(int);
+uint64_t now_ns();
+void    queue_input(CHIP8*, int, int, METRICS*, REWIND*);
+void    record_latency(struct STRUCT_LATENCY*, uint64_t);
+void    print_latency(struct STRUCT_LATENCY*);
+void    print_profile(CHIP8*);
+void    report_fault(CHIP8*, const char*, uint8_t*);
+void    close_view(struct STRUCT_VIEW*);
+int     fast_forward(CHIP8*, char*, bool*);
+int     run_tiled(int, char*[]);
+int     setup_tiles(struct STRUCT_TILES*, int, char*[]);
+void    draw_tile(struct STRUCT_TILES*, int);
+void    present_tiles(struct STRUCT_TILES*);
+void    focus_tile(struct STRUCT_TILES*, int);
+void    close_tiles(struct STRUCT_TILES*);
 
 int main(int argc, char *argv[]) {
     STATE = EMU_ON;
     /*
-        A byte which determines the various modes (see options)
+        A word which determines the various modes (see options)
 
         Default                                 (00000000).
         Verbose ON : right-most bit     ON      (00000001).
         Sound   OFF: 2nd from right bit ON.     (00000010).
+        Step    ON : 3rd from right bit ON.     (00000100).
+        GDB     ON : 4th from right bit ON.     (00001000).
+        Timing  ON : 5th from right bit ON.     (00010000).
+        Phosphor ON: 6th from right bit ON.     (00100000).
+        Scanline ON: 7th from right bit ON.     (01000000).
+        Watch   ON : 8th from right bit ON.     (10000000).
+        Metrics ON : 9th from right bit ON.    (100000000).
+        Until   ON : 10th from right bit ON.  (1000000000).
+        Runahead ON: 11th from right bit ON. (10000000000).
+        Runahead thread ON: 12th bit ON.    (100000000000).
+        Null frontend ON: 13th bit ON.     (1000000000000).
+        Terminal frontend ON: 14th bit ON. (10000000000000).
     */
-    uint8_t MODE = 0;
+    uint32_t MODE = 0;
+    if(argc >= 3 && strcmp(argv[1], "-tile") == 0) {
+        return run_tiled(argc - 2, argv + 2);
+    }
     parse_commands(argc,argv, &MODE);
 
-    STRUCT_SDL sdl_setupvar;
+    STRUCT_VIEW view;
+    cout<< "Initializing CHIP8 instance..."<<endl;
     CHIP8 chip8_instance;
     
     if(setup_rom(&chip8_instance, argv[1], MODE) == -1) {
@@ -78,34 +217,118 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    if(setup_window(&sdl_setupvar) == -1) {
-        cerr<<std::endl<<"could not setup SDL2 window.";
+    if(MODE & MODE_UNT) {
+        bool quit   = false;
+        int  status = fast_forward(&chip8_instance, argc >= 4 ? argv[3] : NULL, &quit);
+        if(status == -1) {
+            cerr<<std::endl<<"invalid run-until predicates."<<std::endl;
+            exit(1);
+        }
+        if(quit) {
+            exit(status == 0 ? 0 : 1);
+        }
+    }
+
+    if(setup_view(&view, &chip8_instance, MODE) == -1) {
+        cerr<<std::endl<<"could not setup the frontend.";
         exit(1);
     }
 
-    if(run_gameloop(&chip8_instance, &sdl_setupvar, REFRESH_TIME) == -1) {
+    GDBSTUB gdb_stub;
+    REWIND *history = NULL;
+    if(MODE & MODE_GDB) {
+        if(gdb_stub.open(GDB_PORT) == -1) {
+            cerr<<std::endl<<"could not start the gdb stub.";
+            exit(1);
+        }
+        history = new REWIND();
+        history->set_interval(rewind_interval);
+        history->clear(&chip8_instance);
+        gdb_stub.set_history(history);
+    }
+
+    STRUCT_WATCH rom_watch;
+    if(setup_watch(&rom_watch, argv[1], MODE) == -1) {
+        cerr<<std::endl<<"could not watch ROM file.";
+        exit(1);
+    }
+
+    METRICS  metrics;
+    METRICS *metrics_registry = NULL;
+    if(MODE & MODE_MTR) {
+        metrics_init(&metrics);
+        metrics_registry = &metrics;
+        chip8_instance.set_metrics(metrics_registry);
+    }
+
+    setup_keypad();
+    STRUCT_LATENCY *latency = new STRUCT_LATENCY();
+
+    STRUCT_RUNAHEAD *runahead = new STRUCT_RUNAHEAD();
+    setup_runahead(runahead, MODE);
+
+    if(run_gameloop(&chip8_instance, &view, REFRESH_TIME, &gdb_stub, history, &rom_watch, metrics_registry, latency, runahead) == -1) {
         cerr <<"error running game loop.";
     }
-    close_window(&sdl_setupvar);
+    if(history != NULL) {
+        cout<<"gdb: history of "<<history->frame_count()<<" keyframes, "<<history->footprint() / 1024<<" KB."<<endl;
+        delete history;
+    }
+    close_runahead(runahead);
+    delete runahead;
+    if(MODE & MODE_TIM) {
+        print_profile(&chip8_instance);
+    }
+    print_latency(latency);
+    delete latency;
+    if(metrics_registry != NULL) {
+        metrics_write(metrics_registry, METRICS_PATH);
+    }
+    close_view(&view);
+    cout<<"CHIP8 instance stopped."<<endl;
+    if(rom_watch.fd != -1) {
+        close(rom_watch.fd);
+    }
 
     return 0;
 }
 
-void parse_commands(int argc, char* argv[], uint8_t *MODE){
+void print_usage() {
+    cout<<"usage: ./chip8 <rom> <-options[hvacsgtflwmurRkSxnT]> [predicates]"<<endl;
+    cout<<"       ./chip8 -tile [-T|-n] <rom> <rom> ... : runs every ROM in one window (TAB / click to focus)."<<endl;
+    cout<<"options:"<<endl;
+    cout<<"\t-h : shows this message."<<endl;
+    cout<<"\t-v : verbose mode, shows interal trace."<<endl;
+    cout<<"\t-a : disables audio."<<endl;
+    cout<<"\t-c : displays controls."<<endl;
+    cout<<"\t-s : single step mode."<<endl;
+    cout<<"\t-g : gdb remote stub on localhost:"<<GDB_PORT<<" (attach any time with 'target remote')."<<endl;
+    cout<<"\t-t : COSMAC VIP timing, instructions are charged machine cycles against a 60Hz frame budget."<<endl;
+    cout<<"\t-f : phosphor persistence, fades pixels out instead of flickering."<<endl;
+    cout<<"\t-l : scanlines."<<endl;
+    cout<<"\t-w : watch the ROM file, and reload it as soon as it is rebuilt."<<endl;
+    cout<<"\t-m : writes runtime metrics (Prometheus text format) to "<<METRICS_PATH<<" every "<<METRICS_PERIOD<<"s."<<endl;
+    cout<<"\t-u : runs unthrottled until one of the comma separated predicates holds, then plays on from there:"<<endl;
+    cout<<"\t     pc=ADDR, instrs=N, vX (changes), vX=VAL, mem=ADDR (changes), frame=N, hash=HASH,"<<endl;
+    cout<<"\t     limit=FRAMES (default "<<UNTIL_MAXFRAMES<<"), exit (quit instead of playing on, status 0 if one held)."<<endl;
+    cout<<"\t-r : run-ahead, presents the frame N (-r1 .. -r"<<RUNAHEAD_MAX<<", default "<<RUNAHEAD_FRAMES<<") frames ahead of the game, to hide input lag (implies -t)."<<endl;
+    cout<<"\t-R : run-ahead on a second core."<<endl;
+    cout<<"\t-k : with -g, keyframe every N instructions for reverse execution (-k"<<REWIND_INTERVAL<<" by default), fewer is faster to seek and uses more memory."<<endl;
+    cout<<"\t-S : runs the ROM as SUPER-CHIP (the default for .sc8 files)."<<endl;
+    cout<<"\t-x : runs the ROM as XO-CHIP (the default for .xo8 files)."<<endl;
+    cout<<"\t-T : shows the ROM in the terminal (the default without SDL, if stdout is a terminal)."<<endl;
+    cout<<"\t-n : headless, shows nothing (e.g. with -g or -m on a server), Ctrl-C quits."<<endl;
+    cout<<endl;
+}
+
+void parse_commands(int argc, char* argv[], uint32_t *MODE){
     if(argc < 2) {
-        cout<<"usage: ./chip8 <rom> <-options[hvac]>"<<endl;
+        cout<<"usage: ./chip8 <rom> <-options[hvacsgtflwmurRkSxnT]> [predicates]"<<endl;
         exit(0);
     }
 
     if(strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "-help") == 0 || strcmp(argv[1], "help") == 0) {
-        cout<<"usage: ./chip8 <rom> <-options[hvac]>"<<endl;
-        cout<<"options:"<<endl;
-        cout<<"\t-h : shows this message."<<endl;
-        cout<<"\t-v : verbose mode, shows interal trace."<<endl;
-        cout<<"\t-a : disables audio."<<endl;
-        cout<<"\t-c : displays controls."<<endl;
-        cout<<"\t-s : single step mode."<<endl;
-        cout<<endl;
+        print_usage();
         exit(0);
     }
 
@@ -114,14 +337,7 @@ void parse_commands(int argc, char* argv[], uint8_t *MODE){
         string options = argv[2];
 
         if(options.find("h") != string::npos){
-            cout<<"usage: ./chip8 <rom> <-options[hvac]>"<<endl;
-            cout<<"options:"<<endl;
-            cout<<"\t-h : shows this message."<<endl;
-            cout<<"\t-v : verbose mode, shows interal trace."<<endl;
-            cout<<"\t-a : disables audio."<<endl;
-            cout<<"\t-c : displays controls."<<endl;
-            cout<<"\t-s : single step mode."<<endl;
-            cout<<endl;
+            print_usage();
             option_correct = true;
         }
 
@@ -150,6 +366,8 @@ void parse_commands(int argc, char* argv[], uint8_t *MODE){
             cout << "\tESC   : Turn OFF Instance"<< endl;
             cout << "\tP     : TOGGLE PAUSE"<< endl;
             cout << "\tENTER : SINGLE STEP Forward (STEP mode)"<< endl;
+            cout << "\tF5    : RESET Instance"<< endl;
+            cout << "\tDROP a ROM file on the window to SWAP to it"<< endl;
             option_correct = true;
         }
 
@@ -159,6 +377,96 @@ void parse_commands(int argc, char* argv[], uint8_t *MODE){
             option_correct = true;
         }
 
+        if(options.find("g") != string::npos) {
+            *MODE |= MODE_GDB;
+            option_correct = true;
+        }
+
+        if(options.find("t") != string::npos) {
+            cout<<"TIMING model is ON."<<endl;
+            *MODE |= MODE_TIM;
+            option_correct = true;
+        }
+
+        if(options.find("f") != string::npos) {
+            cout<<"PHOSPHOR persistence is ON."<<endl;
+            *MODE |= MODE_PFX;
+            option_correct = true;
+        }
+
+        if(options.find("l") != string::npos) {
+            cout<<"SCANLINES are ON."<<endl;
+            *MODE |= MODE_SCN;
+            option_correct = true;
+        }
+
+        if(options.find("w") != string::npos) {
+            cout<<"WATCHING ROM file for changes."<<endl;
+            *MODE |= MODE_WCH;
+            option_correct = true;
+        }
+
+        if(options.find("m") != string::npos) {
+            cout<<"METRICS are written to "<<METRICS_PATH<<"."<<endl;
+            *MODE |= MODE_MTR;
+            option_correct = true;
+        }
+
+        if(options.find("u") != string::npos) {
+            *MODE |= MODE_UNT;
+            option_correct = true;
+        }
+
+        size_t keyframes = options.find("k");
+        if(keyframes != string::npos) {
+            uint64_t interval = strtoull(options.c_str() + keyframes + 1, NULL, 10);
+            if(interval > 0) {
+                rewind_interval = interval;
+            }
+            cout<<"KEYFRAMES every "<<rewind_interval<<" instructions (reverse execution)."<<endl;
+            option_correct = true;
+        }
+
+        if(options.find("S") != string::npos) {
+            cout<<"SUPER-CHIP variant."<<endl;
+            rom_variant = VARIANT_SCHIP;
+            option_correct = true;
+        }
+
+        if(options.find("x") != string::npos) {
+            cout<<"XO-CHIP variant."<<endl;
+            rom_variant = VARIANT_XOCHIP;
+            option_correct = true;
+        }
+
+        if(options.find("T") != string::npos) {
+            cout<<"TERMINAL frontend."<<endl;
+            *MODE |= MODE_TRM;
+            frontend_kind = FRONTEND_TERM;
+            option_correct = true;
+        }
+
+        if(options.find("n") != string::npos) {
+            cout<<"NULL frontend (headless)."<<endl;
+            *MODE |= MODE_NUL;
+            frontend_kind = FRONTEND_NULL;
+            option_correct = true;
+        }
+
+        size_t ahead = options.find_first_of("rR");
+        if(ahead != string::npos) {
+            runahead_frames = RUNAHEAD_FRAMES;
+            if(ahead + 1 < options.size() && options[ahead + 1] >= '1' && options[ahead + 1] <= '0' + RUNAHEAD_MAX) {
+                runahead_frames = options[ahead + 1] - '0';
+            }
+            cout<<"RUN-AHEAD of "<<runahead_frames<<" frame(s) is ON."<<endl;
+            *MODE |= MODE_RUN | MODE_TIM;
+            if(options[ahead] == 'R') {
+                *MODE |= MODE_RUNTHR;
+            }
+            option_correct = true;
+        }
+
         if(!option_correct) {
             cout << "invalid option. check valid options using ./chip -h"<<endl;
             return;
@@ -167,7 +475,7 @@ void parse_commands(int argc, char* argv[], uint8_t *MODE){
     
 }
 
-int setup_rom(CHIP8 *chip8_instance, char *rom, uint8_t MODE) {
+int setup_rom(CHIP8 *chip8_instance, char *rom, uint32_t MODE) {
     //for now call load_rom directly, add fancy path checkers later
     bool sound = false;
     bool verbose = false;
@@ -183,68 +491,254 @@ int setup_rom(CHIP8 *chip8_instance, char *rom, uint8_t MODE) {
         step = true;
     }
 
+    chip8_instance->set_variant(rom_variant != -1 ? rom_variant : variant_of(rom));
+    chip8_instance->set_timing(MODE & MODE_TIM);
+    chip8_instance->set_profiling(MODE & MODE_TIM);
+    chip8_instance->set_fusion(MODE & MODE_TIM ? FUSE_DEFAULT : 0);
+
     return chip8_instance->load_rom(rom, sound, verbose, step);
 }
 
-int setup_window(struct STRUCT_SDL* sdl_setupvar) {
-    if ( SDL_Init( SDL_INIT_EVERYTHING ) < 0 ) {
-        cerr << "Error initializing SDL: " << SDL_GetError() << endl;
-        system("pause");
-        return -1;
-    } 
+/*
+    Returns the variant a ROM file is for, from its extension.
+*/
+int variant_of(char *rom) {
+    string path = rom;
+    string ext  = path.substr(path.find_last_of('.') == string::npos ? path.size() : path.find_last_of('.'));
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if(ext == ".sc8") {
+        return VARIANT_SCHIP;
+    }
+    if(ext == ".xo8") {
+        return VARIANT_XOCHIP;
+    }
+    return VARIANT_CHIP8;
+}
 
-    sdl_setupvar->window = SDL_CreateWindow( "CHIP8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WIN_WD, WIN_HT, SDL_WINDOW_SHOWN );
+/*
+    Opens the frontend (-n, -T, or frontend_default()) for the display of the instance.
+    Returns 0 on success, -1 on error.
+*/
+int setup_view(struct STRUCT_VIEW* view, CHIP8 *chip8_instance, uint32_t MODE) {
+    int kind = frontend_kind != -1 ? frontend_kind : frontend_default();
+    view->frontend  = frontend_create(kind);
+    view->fading    = false;
+    view->sound     = !(MODE & MODE_SND);
+    view->last_hash = ~chip8_instance->frame_hash();
+    if(view->frontend == NULL) {
+        cerr << "this build has no SDL2 window (make SDL=1), use -T or -n." << endl;
+        return -1;
+    }
 
-	if ( !sdl_setupvar->window ) {
-		cout << "Error creating window: " << SDL_GetError()  << endl;
-		system("pause");
-		return -1;
-	}
+    uint32_t flags = (MODE & MODE_PFX ? FE_PHOSPHOR : 0) | (MODE & MODE_SCN ? FE_SCANLINES : 0) | (view->sound ? FE_SOUND : 0);
+    return view->frontend->open(chip8_instance->get_width(), chip8_instance->get_height(), WIN_WD, WIN_HT, flags);
+}
 
-    sdl_setupvar->renderer = SDL_CreateRenderer( sdl_setupvar->window, -1, 0 );
-	if ( !sdl_setupvar->renderer ) {
-		cout << "Error creating renderer: " << SDL_GetError() << endl;
-		return -1;
-	}
+/*
+    Sets up an inotify watch on the directory of ROM (if watch mode is ON).
+    The directory is watched rather than the file, since builds usually replace the file.
+    Returns 0 on success, -1 on error.
+*/
+int setup_watch(struct STRUCT_WATCH* rom_watch, char *rom, uint32_t MODE) {
+    rom_watch->fd = -1;
+    if(!(MODE & MODE_WCH)) {
+        return 0;
+    }
 
-    SDL_RenderSetLogicalSize(sdl_setupvar->renderer, WIN_WD, WIN_HT);
+    /* dirname and basename may modify their argument */
+    string dir_path  = rom;
+    string base_path = rom;
+    rom_watch->dir   = dirname(&dir_path[0]);
+    rom_watch->name  = basename(&base_path[0]);
 
-    sdl_setupvar->texture = SDL_CreateTexture(sdl_setupvar->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, MAX_WIDTH, MAX_HEIGHT);
-    if (sdl_setupvar->texture == NULL)
-    {
-        std::cerr << "Error in setting up texture " << SDL_GetError() << std::endl;
-        SDL_Quit();
+    rom_watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(rom_watch->fd == -1) {
+        return -1;
+    }
+    if(inotify_add_watch(rom_watch->fd, rom_watch->dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        close(rom_watch->fd);
+        rom_watch->fd = -1;
         return -1;
     }
     return 0;
 }
 
-int run_gameloop(CHIP8 *chip8_instance, struct STRUCT_SDL* sdl_setupvar, int refresh_time) {
+/*
+    Returns true if the ROM file was rewritten since the last call. Never blocks.
+*/
+bool poll_watch(struct STRUCT_WATCH* rom_watch) {
+    if(rom_watch->fd == -1) {
+        return false;
+    }
+
+    bool changed = false;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while((len = read(rom_watch->fd, buf, sizeof(buf))) > 0) {
+        for(char *ptr = buf; ptr < buf + len; ) {
+            struct inotify_event *event = (struct inotify_event*) ptr;
+            if(event->len > 0 && rom_watch->name == event->name) {
+                changed = true;
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+/*
+    Builds the keyboard to keypad lookup from keymap.
+*/
+void setup_keypad() {
+    memset(keypad_lut, -1, sizeof(keypad_lut));
+    for(int i = 0; i < MAX_KEYCOUNT; i++) {
+        if(keymap[i] < KEYPAD_LUTSIZE) {
+            keypad_lut[keymap[i]] = i;
+        }
+    }
+}
+
+/*
+    Returns the keypad index of keyboard key KEY (FE_KEY_*), -1 if it is not mapped.
+*/
+int keypad_index(int key) {
+    if(key < 0 || key >= KEYPAD_LUTSIZE) {
+        return -1;
+    }
+    return keypad_lut[key];
+}
+
+/*
+    Host monotonic time in nanoseconds.
+*/
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+    Records an input-to-photon latency sample of NS nanoseconds.
+*/
+void record_latency(struct STRUCT_LATENCY* latency, uint64_t ns) {
+    latency->samples[latency->count % LATENCY_SAMPLES] = ns / 1000;
+    latency->count++;
+}
+
+/*
+    Prints the input-to-photon latency percentiles over the last LATENCY_SAMPLES samples.
+*/
+void print_latency(struct STRUCT_LATENCY* latency) {
+    if(latency->count == 0) {
+        return;
+    }
+    size_t n = std::min<uint64_t>(latency->count, LATENCY_SAMPLES);
+    vector<uint32_t> sorted(latency->samples, latency->samples + n);
+    sort(sorted.begin(), sorted.end());
+
+    cout << "INPUT-TO-PHOTON latency (" << dec << n << " samples): "
+         << "p50 " << sorted[n * 50 / 100] / 1000.0 << "ms, "
+         << "p90 " << sorted[n * 90 / 100] / 1000.0 << "ms, "
+         << "p99 " << sorted[n * 99 / 100] / 1000.0 << "ms, "
+         << "max " << sorted[n - 1] / 1000.0 << "ms." << endl;
+}
+
+/*
+    Queues keyboard key SYM (FE_KEY_*) going to VAL on the instance, stamped with the host time
+    and the next instruction, so the game sees it at a deterministic point.
+*/
+void queue_input(CHIP8 *chip8_instance, int sym, int val, METRICS *metrics, REWIND *history) {
+    int key = keypad_index(sym);
+    if(key == -1) {
+        return;
+    }
+    /* back in time (debugger), the keys are the recorded ones */
+    if(history && history->in_past(chip8_instance)) {
+        return;
+    }
+    if(chip8_instance->queue_key(key, val, chip8_instance->get_instrs(), now_ns()) == -1) {
+        /* queue full (e.g. halted by the debugger), apply right away */
+        chip8_instance->set_key(key, val);
+    }
+    if(history) {
+        history->record_key(chip8_instance, key, val);
+    }
+    if(metrics) {
+        metrics_inc(metrics->key_events);
+    }
+}
+
+int run_gameloop(CHIP8 *chip8_instance, struct STRUCT_VIEW* view, int refresh_time, GDBSTUB *gdb_stub, REWIND *history, struct STRUCT_WATCH* rom_watch, METRICS *metrics, struct STRUCT_LATENCY* latency, struct STRUCT_RUNAHEAD* runahead) {
     if(STATE == EMU_ON) {
         STATE = EMU_RUN;
     }
 
+    /*
+        with the timing model, each pass of the loop is one 60Hz frame
+        (a cycle budget, see CHIP8::run_frame), otherwise one instruction.
+    */
+    bool     per_frame   = chip8_instance->get_timing() && !chip8_instance->get_STP();
+    uint64_t frame_ns    = 1000000000 / VIP_FRAME_RATE;
+    uint64_t next_frame  = now_ns() + frame_ns;
+    uint64_t last_present = 0;
+    uint64_t next_metrics = now_ns() + 1000000000ull * METRICS_PERIOD;
+    uint8_t  faults       = 0;
+
     while(STATE == EMU_RUN || STATE == EMU_STOP){
 
-        if(STATE == EMU_RUN) {
-            if(chip8_instance->cycle() == -1) {
+        /* a debugger may attach (and halt us) at any time */
+        gdb_stub->poll(chip8_instance);
+
+        /* reload the ROM in place when it has been rebuilt */
+        if(poll_watch(rom_watch)) {
+            string path = rom_watch->dir + "/" + rom_watch->name;
+            if(chip8_instance->swap_rom(&path[0]) == 0) {
+                cout << "ROM changed, reloaded." << endl;
+                if(history) {
+                    history->clear(chip8_instance);
+                }
+            }
+        }
+
+        /* the frame shown: the real one, or the speculative one with run-ahead */
+        CHIP8 *shown = chip8_instance;
+        bool   ahead = false;
+
+        if(STATE == EMU_RUN && !gdb_stub->is_halted()) {
+            /* left back in time by the debugger: the recorded future is dropped */
+            if(history && history->in_past(chip8_instance)) {
+                history->cut(chip8_instance);
+            }
+            int status = per_frame ? chip8_instance->run_frame() : chip8_instance->cycle();
+            if(status == -1) {
                 cerr << "Error in CHIP8 cycle.";
                 return -1;
             }
+            if(history) {
+                history->record(chip8_instance);
+            }
+            report_fault(chip8_instance, NULL, &faults);
+            if(status == DBG_STOP) {
+                gdb_stub->stopped(chip8_instance);
+            } else if(per_frame && runahead->frames > 0) {
+                start_runahead(runahead, chip8_instance);
+                ahead = true;
+            }
         } else if(STATE == EMU_STOP) {
             //do nothing
         }
         
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            if(event.type == SDL_QUIT){
+        FE_EVENT event;
+        while (view->frontend->poll(&event)) {
+            if(event.type == FE_QUIT){
                 STATE = EMU_OFF;
+                finish_runahead(runahead);
                 return 0;
             }
 
-            if(event.type == SDL_KEYDOWN) {
+            if(event.type == FE_KEYDOWN) {
 
-                if (event.key.keysym.sym == SDLK_p) {
+                if (event.key == 'p') {
                     if(STATE == EMU_RUN) {
                         cout << "Instance stopped. Press 'P' to CONTINUE." << endl;;
                         STATE = EMU_STOP;
@@ -256,52 +750,93 @@ int run_gameloop(CHIP8 *chip8_instance, struct STRUCT_SDL* sdl_setupvar, int ref
                     }
                 }
 
-                if (event.key.keysym.sym == SDLK_ESCAPE) {
+                if (event.key == FE_KEY_ESCAPE) {
                     STATE = EMU_OFF;
+                    finish_runahead(runahead);
                     return 0;
                 }
 
-                for (int i = 0; i < MAX_KEYCOUNT; i++)
-                {
-                    if (event.key.keysym.sym == keymap[i])
-                    {
-                        chip8_instance->set_key(i, KEY_DOWN);
+                if (event.key == FE_KEY_F5) {
+                    cout << "Instance reset." << endl;
+                    chip8_instance->reset();
+                    if(history) {
+                        history->clear(chip8_instance);
                     }
-                }                
+                }
+
+                queue_input(chip8_instance, event.key, KEY_DOWN, metrics, history);
             }
 
-            if(event.type == SDL_KEYUP) {
-                for (int i = 0; i < MAX_KEYCOUNT; i++)
-                {
-                    if (event.key.keysym.sym == keymap[i])
-                    {
-                        chip8_instance->set_key(i, KEY_UP);
+            if(event.type == FE_DROP) {
+                if(chip8_instance->swap_rom(&event.path[0]) == 0) {
+                    cout << "Swapped to ROM " << event.path << "." << endl;
+                    if(history) {
+                        history->clear(chip8_instance);
                     }
-                } 
+                }
+            }
+
+            if(event.type == FE_KEYUP) {
+                queue_input(chip8_instance, event.key, KEY_UP, metrics, history);
             }
         }
+        if(view->sound) {
+            view->frontend->tone(chip8_instance->get_ST() > 0);
+        }
         /*
-            Update screen if drawflag is set.
+            Update screen if drawflag is set,
+            or (at most at 60Hz) while the phosphor is still fading.
         */
-        if(chip8_instance->get_drawflag() == true) {
-            uint32_t video_buffer[MAX_DISPSIZE];
-            for(int i=0; i<MAX_DISPSIZE; i++){
-                if(chip8_instance->get_pixel(i) == PIX_ON) {
-                    video_buffer[i] = PIX_ON_COLOR;
-                } else {
-                    video_buffer[i] = PIX_OFF_COLOR;
+        if(ahead) {
+            shown = finish_runahead(runahead);
+        }
+        uint64_t now = now_ns();
+        if(chip8_instance->get_drawflag() == true || shown->get_drawflag() == true ||
+           (view->fading && now - last_present >= frame_ns)) {
+            bool changed = present_frame(shown, view);
+            chip8_instance->set_drawflag(false);
+
+            /* the first changed frame after a key event is where the input shows up */
+            uint64_t input_ns = changed ? chip8_instance->take_input_stamp() : 0;
+            if(input_ns != 0) {
+                uint64_t photon_ns = now_ns() - input_ns;
+                record_latency(latency, photon_ns);
+                if(metrics) {
+                    metrics_observe(&metrics->input_to_photon, photon_ns);
                 }
             }
-            
-            SDL_UpdateTexture(sdl_setupvar->texture, NULL, &video_buffer, MAX_WIDTH * sizeof(uint32_t));
-            SDL_RenderClear(sdl_setupvar->renderer);
-            SDL_RenderCopy(sdl_setupvar->renderer, sdl_setupvar->texture , NULL, NULL);
-            SDL_RenderPresent(sdl_setupvar->renderer);
 
-            chip8_instance->set_drawflag(false);
+            if(metrics) {
+                uint64_t done = now_ns();
+                metrics_inc(metrics->presents);
+                metrics_observe(&metrics->present_latency, done - now);
+                if(last_present != 0) {
+                    metrics_observe(&metrics->frame_time, now - last_present);
+                }
+            }
+            last_present = now;
         }
 
-        usleep(refresh_time);
+        if(metrics && now >= next_metrics) {
+            metrics_write(metrics, METRICS_PATH);
+            next_metrics = now + 1000000000ull * METRICS_PERIOD;
+        }
+
+        if(per_frame) {
+            /* sleep until the next frame is due, skipping ahead if we fell behind */
+            uint64_t now = now_ns();
+            if(now < next_frame) {
+                usleep((next_frame - now) / 1000);
+                next_frame += frame_ns;
+            } else {
+                next_frame = now + frame_ns;
+                if(metrics) {
+                    metrics_inc(metrics->dropped_frames);
+                }
+            }
+        } else {
+            usleep(refresh_time);
+        }
 
         if(chip8_instance->get_STP() == true) {
             std::string temp;
@@ -315,15 +850,477 @@ int run_gameloop(CHIP8 *chip8_instance, struct STRUCT_SDL* sdl_setupvar, int ref
 
     return 0;
 }
-void close_window(struct STRUCT_SDL* sdl_setupvar) {
-    SDL_DestroyTexture(sdl_setupvar->texture);
-    SDL_DestroyRenderer(sdl_setupvar->renderer);
-    SDL_DestroyWindow(sdl_setupvar->window);
-
-    sdl_setupvar->texture = NULL;
-    sdl_setupvar->renderer = NULL;
-    sdl_setupvar->window = NULL;
-
-    SDL_Quit();
-    return;
-}
\ No newline at end of file
+/*
+    Sets up run-ahead (if it is ON), and starts the worker thread for -R.
+*/
+void setup_runahead(struct STRUCT_RUNAHEAD* runahead, uint32_t MODE) {
+    runahead->frames   = (MODE & MODE_RUN) ? runahead_frames : 0;
+    runahead->threaded = runahead->frames > 0 && (MODE & MODE_RUNTHR);
+    runahead->pending  = false;
+    runahead->quit     = false;
+    runahead->ahead.set_fusion(FUSE_DEFAULT);
+    if(runahead->threaded) {
+        runahead->worker = thread(runahead_worker, runahead);
+    }
+}
+
+/*
+    Snapshots CHIP8_INSTANCE and runs the copy ahead, here or on the worker.
+    The snapshot shares every memory page (copy-on-write), so it costs a
+    few hundred bytes of copying, and dropping it gives the pages back.
+*/
+void start_runahead(struct STRUCT_RUNAHEAD* runahead, CHIP8 *chip8_instance) {
+    runahead->ahead = *chip8_instance;
+    if(!runahead->threaded) {
+        for(int f = 0; f < runahead->frames; f++) {
+            runahead->ahead.run_frame();
+        }
+        return;
+    }
+    lock_guard<mutex> guard(runahead->lock);
+    runahead->pending = true;
+    runahead->wake.notify_all();
+}
+
+/*
+    Waits for the speculative frames, returns the instance to present.
+*/
+CHIP8* finish_runahead(struct STRUCT_RUNAHEAD* runahead) {
+    if(runahead->threaded) {
+        unique_lock<mutex> guard(runahead->lock);
+        while(runahead->pending) {
+            runahead->wake.wait(guard);
+        }
+    }
+    return &runahead->ahead;
+}
+
+void runahead_worker(struct STRUCT_RUNAHEAD* runahead) {
+    unique_lock<mutex> guard(runahead->lock);
+    while(true) {
+        while(!runahead->pending && !runahead->quit) {
+            runahead->wake.wait(guard);
+        }
+        if(runahead->quit) {
+            return;
+        }
+        guard.unlock();
+        for(int f = 0; f < runahead->frames; f++) {
+            runahead->ahead.run_frame();
+        }
+        guard.lock();
+        runahead->pending = false;
+        runahead->wake.notify_all();
+    }
+}
+
+void close_runahead(struct STRUCT_RUNAHEAD* runahead) {
+    if(runahead->threaded) {
+        {
+            lock_guard<mutex> guard(runahead->lock);
+            runahead->quit = true;
+            runahead->wake.notify_all();
+        }
+        runahead->worker.join();
+    }
+}
+
+/*
+    Presents the display on the frontend. A frame equal to the last one (same frame_hash, e.g. a
+    sprite erased and drawn back) is not converted again, unless the phosphor is still fading.
+    Returns true if the frame changed.
+*/
+bool present_frame(CHIP8 *chip8_instance, struct STRUCT_VIEW* view) {
+    uint64_t hash    = chip8_instance->frame_hash();
+    bool     changed = hash != view->last_hash;
+    view->last_hash  = hash;
+
+    uint8_t pixels[HIRES_DISPSIZE];
+    if(changed || view->fading) {
+        chip8_instance->get_frame(pixels);
+    }
+    view->fading = view->frontend->present(pixels, changed);
+    return changed;
+}
+
+/*
+    Parses the run-until predicates in SPEC (see print_usage) and runs the instance
+    unthrottled until one holds, then reports where it stopped.
+    QUIT is set if the spec asks to exit afterwards.
+    Returns 0 if a predicate held, 1 if the frame limit was reached first, -1 on error.
+*/
+int fast_forward(CHIP8 *chip8_instance, char *spec, bool *quit) {
+    if(spec == NULL) {
+        return -1;
+    }
+
+    UNTIL_PRED     preds[UNTIL_MAXPREDS];
+    vector<string> names;
+    uint64_t       limit = UNTIL_MAXFRAMES;
+    string         specs = spec;
+    size_t         start = 0;
+
+    while(start <= specs.size()) {
+        size_t end = specs.find(',', start);
+        if(end == string::npos) {
+            end = specs.size();
+        }
+        string token = specs.substr(start, end - start);
+        start = end + 1;
+        if(token.empty()) {
+            continue;
+        }
+
+        size_t      eq    = token.find('=');
+        string      key   = token.substr(0, eq);
+        uint64_t    value = eq == string::npos ? 0 : strtoull(token.c_str() + eq + 1, NULL, 0);
+        UNTIL_PRED  pred  = {0, 0, value};
+
+        if(key == "exit") {
+            *quit = true;
+            continue;
+        } else if(key == "limit") {
+            limit = value;
+            continue;
+        } else if(key == "pc") {
+            pred.kind = UNTIL_PC;
+        } else if(key == "instrs") {
+            pred.kind = UNTIL_INSTRS;
+        } else if(key == "frame") {
+            pred.kind = UNTIL_FRAME;
+        } else if(key == "hash") {
+            pred.kind = UNTIL_HASH;
+        } else if(key == "mem") {
+            pred.kind = UNTIL_MEM;
+            pred.arg  = value;
+        } else if(key.size() == 2 && (key[0] == 'v' || key[0] == 'V') && isxdigit(key[1])) {
+            pred.kind = eq == string::npos ? UNTIL_REG : UNTIL_REGEQ;
+            pred.arg  = strtoul(key.c_str() + 1, NULL, 16);
+        } else {
+            return -1;
+        }
+        if(names.size() == UNTIL_MAXPREDS) {
+            return -1;
+        }
+        preds[names.size()] = pred;
+        names.push_back(token);
+    }
+
+    uint64_t frames = chip8_instance->get_cycles() / VIP_CYCLES_PER_FRAME;
+    uint64_t instrs = chip8_instance->get_instrs();
+    uint64_t start_ns = now_ns();
+    int      status   = chip8_instance->run_until(preds, names.size(), limit);
+    double   ms       = (now_ns() - start_ns) / 1e6;
+    if(status == -1) {
+        return -1;
+    }
+
+    cout << "RUN-UNTIL: ";
+    if(status >= 0) {
+        cout << names[status] << " after ";
+    } else if(status == UNTIL_EXPIRED) {
+        cout << "nothing held in ";
+    } else {
+        cout << "stopped by a debugpoint after ";
+    }
+    cout << dec << chip8_instance->get_cycles() / VIP_CYCLES_PER_FRAME - frames << " frames, "
+         << chip8_instance->get_instrs() - instrs << " instructions, in " << ms << "ms. "
+         << "PC = 0x" << hex << chip8_instance->get_PC()
+         << ", frame hash = 0x" << chip8_instance->frame_hash() << dec << "." << endl;
+    uint8_t faults = 0;
+    report_fault(chip8_instance, NULL, &faults);
+
+    return status >= 0 ? 0 : 1;
+}
+
+/*
+    Reports the faults (see CHIP8::get_fault) raised since the last call, with the address of the
+    instruction which raised the first one, and clears them. REPORTED holds the FAULT_* kinds already
+    reported: a ROM faulting every frame is reported once. NAME is the ROM, for tiles (NULL if alone).
+*/
+void report_fault(CHIP8 *chip8_instance, const char *name, uint8_t *reported) {
+    uint8_t fault = chip8_instance->get_fault();
+    if(fault == 0) {
+        return;
+    }
+    uint16_t pc = chip8_instance->get_fault_pc();
+    chip8_instance->clear_fault();
+    if((fault & ~*reported) == 0) {
+        return;
+    }
+    *reported |= fault;
+    cerr << "FAULT: " << CHIP8::fault_name(fault) << " at PC = 0x" << hex << pc << dec;
+    if(name != NULL) {
+        cerr << " in " << name;
+    }
+    cerr << ", wrapped around and running on." << endl;
+}
+
+/*
+    Prints the cumulative machine cycle counters, broken down by leading opcode nibble.
+*/
+void print_profile(CHIP8 *chip8_instance) {
+    uint64_t cycles = chip8_instance->get_cycles();
+    uint64_t instrs = chip8_instance->get_instrs();
+    if(cycles == 0) {
+        return;
+    }
+
+    cout << "PROFILE: " << dec << instrs << " instructions, " << cycles << " machine cycles ("
+         << (double) cycles / VIP_CYCLES_PER_FRAME << " frames)." << endl;
+    for(int m = 0; m < 16; m++) {
+        uint64_t op_cycles = chip8_instance->get_op_cycles(m);
+        if(op_cycles == 0) {
+            continue;
+        }
+        cout << "\t" << hex << uppercase << m << "xxx : " << dec << op_cycles << " cycles ("
+             << (100.0 * op_cycles / cycles) << "%)" << endl;
+    }
+}
+
+void close_view(struct STRUCT_VIEW* view) {
+    delete view->frontend;
+    view->frontend = NULL;
+}
+
+/*
+    Tiled mode: runs every ROM in ROMS as its own instance, shown as tiles of one window.
+    The instances share one scheduler: every 60Hz refresh each runs one frame
+    (timing model), the tiles which were drawn are converted into the atlas,
+    and the atlas is uploaded and presented once, whatever the number of instances.
+    The focused tile gets the keyboard, F5 and dropped ROMs.
+*/
+int run_tiled(int count, char *roms[]) {
+    /* -T / -n before the ROMs picks the frontend */
+    if(count > 1 && (strcmp(roms[0], "-T") == 0 || strcmp(roms[0], "-n") == 0)) {
+        frontend_kind = roms[0][1] == 'T' ? FRONTEND_TERM : FRONTEND_NULL;
+        count--;
+        roms++;
+    }
+    STRUCT_TILES tiles;
+    if(setup_tiles(&tiles, count, roms) == -1) {
+        cerr<<std::endl<<"could not setup tiled mode."<<std::endl;
+        close_tiles(&tiles);
+        return 1;
+    }
+    setup_keypad();
+    STATE = EMU_RUN;
+
+    uint64_t frame_ns    = 1000000000 / VIP_FRAME_RATE;
+    uint64_t next_frame  = now_ns() + frame_ns;
+    bool     dirty       = true;
+
+    while(STATE == EMU_RUN || STATE == EMU_STOP) {
+        if(STATE == EMU_RUN) {
+            for(size_t i = 0; i < tiles.instances.size(); i++) {
+                if(tiles.halted[i]) {
+                    continue;
+                }
+                if(tiles.instances[i]->run_frame() == -1) {
+                    cerr << "Error in CHIP8 cycle of " << roms[i] << ", stopped." << endl;
+                    tiles.halted[i] = true;
+                    draw_tile(&tiles, i);
+                    dirty = true;
+                }
+                report_fault(tiles.instances[i], roms[i], &tiles.faults[i]);
+                /* a frame equal to the one in the tile (same frame_hash) is not converted again */
+                if(tiles.instances[i]->get_drawflag()) {
+                    tiles.instances[i]->set_drawflag(false);
+                    if(tiles.instances[i]->frame_hash() != tiles.shown[i]) {
+                        draw_tile(&tiles, i);
+                        dirty = true;
+                    }
+                }
+            }
+        }
+
+        CHIP8 *focused = tiles.instances[tiles.focus];
+        FE_EVENT event;
+        while (tiles.frontend->poll(&event)) {
+            if(event.type == FE_QUIT) {
+                STATE = EMU_OFF;
+            }
+
+            if(event.type == FE_KEYDOWN) {
+                if (event.key == FE_KEY_ESCAPE) {
+                    STATE = EMU_OFF;
+                }
+                if (event.key == 'p') {
+                    STATE = STATE == EMU_RUN ? EMU_STOP : EMU_RUN;
+                    cout << (STATE == EMU_RUN ? "Instances running." : "Instances stopped. Press 'P' to CONTINUE.") << endl;
+                }
+                if (event.key == FE_KEY_TAB) {
+                    focus_tile(&tiles, (tiles.focus + 1) % tiles.instances.size());
+                    focused = tiles.instances[tiles.focus];
+                    dirty = true;
+                }
+                if (event.key == FE_KEY_F5) {
+                    focused->reset();
+                    tiles.halted[tiles.focus] = false;
+                    /* the border is no longer red even if the frame did not change */
+                    draw_tile(&tiles, tiles.focus);
+                    dirty = true;
+                }
+                queue_input(focused, event.key, KEY_DOWN, NULL, NULL);
+            }
+
+            if(event.type == FE_KEYUP) {
+                queue_input(focused, event.key, KEY_UP, NULL, NULL);
+            }
+
+            /* clicks are in atlas pixels */
+            if(event.type == FE_CLICK) {
+                int tile = (event.y / TILE_HT) * tiles.cols + event.x / TILE_WD;
+                if(event.x >= 0 && event.y >= 0 && event.x < tiles.cols * TILE_WD &&
+                   tile < (int) tiles.instances.size()) {
+                    focus_tile(&tiles, tile);
+                    focused = tiles.instances[tiles.focus];
+                    dirty = true;
+                }
+            }
+
+            if(event.type == FE_DROP) {
+                if(focused->swap_rom(&event.path[0]) == 0) {
+                    cout << "Swapped tile " << tiles.focus << " to ROM " << event.path << "." << endl;
+                    tiles.halted[tiles.focus] = false;
+                    draw_tile(&tiles, tiles.focus);
+                    dirty = true;
+                }
+            }
+        }
+
+        if(dirty) {
+            present_tiles(&tiles);
+            dirty = false;
+        }
+
+        /* sleep until the next frame is due, skipping ahead if we fell behind */
+        uint64_t now = now_ns();
+        if(now < next_frame) {
+            usleep((next_frame - now) / 1000);
+            next_frame += frame_ns;
+        } else {
+            next_frame = now + frame_ns;
+        }
+    }
+
+    close_tiles(&tiles);
+    cout<<"CHIP8 instances stopped."<<endl;
+    return 0;
+}
+
+/*
+    Loads COUNT ROMs into instances (timing model ON), and creates a window
+    with one streaming texture holding the tile atlas.
+    Returns 0 on success, -1 on error.
+*/
+int setup_tiles(struct STRUCT_TILES* tiles, int count, char *roms[]) {
+    tiles->frontend = NULL;
+    tiles->atlas    = NULL;
+    tiles->focus    = 0;
+
+    if(count > TILE_MAXCOUNT) {
+        cerr << "at most " << TILE_MAXCOUNT << " ROMs in tiled mode." << endl;
+        return -1;
+    }
+
+    cout<< "Initializing " << count << " CHIP8 instances..."<<endl;
+    for(int i = 0; i < count; i++) {
+        CHIP8 *chip8_instance = new CHIP8();
+        tiles->instances.push_back(chip8_instance);
+        tiles->halted.push_back(false);
+        tiles->shown.push_back(0);
+        tiles->faults.push_back(0);
+        if(setup_rom(chip8_instance, roms[i], MODE_TIM) == -1) {
+            cerr << "could not open ROM file " << roms[i] << "." << endl;
+            return -1;
+        }
+        chip8_instance->set_profiling(false);
+    }
+
+    /* a square grid of 2:1 tiles, so the window keeps the shape of one display */
+    tiles->cols = 1;
+    while(tiles->cols * tiles->cols < count) {
+        tiles->cols++;
+    }
+    tiles->rows = (count + tiles->cols - 1) / tiles->cols;
+
+    int atlas_wd = tiles->cols * TILE_WD;
+    int atlas_ht = tiles->rows * TILE_HT;
+    tiles->atlas = new uint8_t[atlas_wd * atlas_ht];
+    memset(tiles->atlas, FE_BORDER, atlas_wd * atlas_ht);
+
+    tiles->frontend = frontend_create(frontend_kind != -1 ? frontend_kind : frontend_default());
+    if(tiles->frontend == NULL) {
+        cerr << "this build has no SDL2 window (make SDL=1), use -T or -n." << endl;
+        return -1;
+    }
+    int scale = std::max(1, std::min(TILE_SCALE, std::min(1600 / atlas_wd, 900 / atlas_ht)));
+    if(tiles->frontend->open(atlas_wd, atlas_ht, atlas_wd * scale, atlas_ht * scale, FE_RESIZABLE) == -1) {
+        return -1;
+    }
+
+    for(int i = 0; i < count; i++) {
+        draw_tile(tiles, i);
+    }
+    return 0;
+}
+
+/*
+    Converts the display of instance INDEX (and its border) into its tile of the atlas.
+*/
+void draw_tile(struct STRUCT_TILES* tiles, int index) {
+    int       pitch  = tiles->cols * TILE_WD;
+    uint8_t  *origin = &tiles->atlas[(index / tiles->cols) * TILE_HT * pitch + (index % tiles->cols) * TILE_WD];
+
+    uint8_t  border = tiles->halted[index] ? FE_HALT :
+                      index == tiles->focus ? FE_FOCUS : FE_BORDER;
+    for(int x = 0; x < TILE_WD; x++) {
+        origin[x] = border;
+        origin[(TILE_HT - 1) * pitch + x] = border;
+    }
+
+    /* a 128 x 64 display is shown at half size, every other pixel */
+    uint8_t pixels[HIRES_DISPSIZE];
+    int     width = tiles->instances[index]->get_width();
+    int     step  = width / MAX_WIDTH;
+    tiles->instances[index]->get_frame(pixels);
+    tiles->shown[index] = tiles->instances[index]->frame_hash();
+    for(int y = 0; y < MAX_HEIGHT; y++) {
+        uint8_t  *line = &origin[(y + 1) * pitch];
+        line[0] = border;
+        for(int x = 0; x < MAX_WIDTH; x++) {
+            line[x + 1] = pixels[y * step * width + x * step];
+        }
+        line[TILE_WD - 1] = border;
+    }
+}
+
+/*
+    Presents the atlas: one image (one texture update and one copy with SDL) for all the tiles.
+*/
+void present_tiles(struct STRUCT_TILES* tiles) {
+    tiles->frontend->present(tiles->atlas, true);
+}
+
+/*
+    Moves the keyboard focus to instance INDEX, redrawing both borders.
+*/
+void focus_tile(struct STRUCT_TILES* tiles, int index) {
+    int previous = tiles->focus;
+    tiles->focus = index;
+    draw_tile(tiles, previous);
+    draw_tile(tiles, index);
+}
+
+void close_tiles(struct STRUCT_TILES* tiles) {
+    for(size_t i = 0; i < tiles->instances.size(); i++) {
+        delete tiles->instances[i];
+    }
+    tiles->instances.clear();
+    delete[] tiles->atlas;
+    tiles->atlas = NULL;
+
+    delete tiles->frontend;
+    tiles->frontend = NULL;
+}
@@ -0,0 +1,92 @@
+/*
+
+    The metrics registry and its Prometheus text exposition.
+
+*/
+
+#include "metrics.h"
+#include <cstdio>
+#include <string>
+
+/* upper bounds of the histogram buckets, in seconds */
+static const double FRAME_TIME_BOUNDS[METRICS_BUCKETS - 1] = {
+    0.001, 0.002, 0.004, 0.008, 0.0167, 0.033, 0.05, 0.1, 0.25
+};
+static const double PRESENT_LATENCY_BOUNDS[METRICS_BUCKETS - 1] = {
+    0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.002, 0.004, 0.008, 0.016
+};
+
+static void histogram_init(HISTOGRAM *hist, const double *bounds) {
+    hist->bounds = bounds;
+    for(int i = 0; i < METRICS_BUCKETS; i++) {
+        hist->buckets[i].store(0, std::memory_order_relaxed);
+    }
+    hist->sum_ns.store(0, std::memory_order_relaxed);
+}
+
+void metrics_init(METRICS *metrics) {
+    metrics->instructions.store(0, std::memory_order_relaxed);
+    metrics->draws.store(0, std::memory_order_relaxed);
+    metrics->presents.store(0, std::memory_order_relaxed);
+    metrics->key_events.store(0, std::memory_order_relaxed);
+    metrics->dropped_frames.store(0, std::memory_order_relaxed);
+    histogram_init(&metrics->frame_time, FRAME_TIME_BOUNDS);
+    histogram_init(&metrics->present_latency, PRESENT_LATENCY_BOUNDS);
+    histogram_init(&metrics->input_to_photon, FRAME_TIME_BOUNDS);
+}
+
+void metrics_observe(HISTOGRAM *hist, uint64_t ns) {
+    double seconds = ns / 1e9;
+    int bucket = 0;
+    while(bucket < METRICS_BUCKETS - 1 && seconds > hist->bounds[bucket]) {
+        bucket++;
+    }
+    hist->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    hist->sum_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+static void write_counter(FILE *file, const char *name, const char *help, std::atomic<uint64_t>& counter) {
+    fprintf(file, "# HELP %s %s\n", name, help);
+    fprintf(file, "# TYPE %s counter\n", name);
+    fprintf(file, "%s %llu\n", name, (unsigned long long) counter.load(std::memory_order_relaxed));
+}
+
+static void write_histogram(FILE *file, const char *name, const char *help, HISTOGRAM *hist) {
+    fprintf(file, "# HELP %s %s\n", name, help);
+    fprintf(file, "# TYPE %s histogram\n", name);
+
+    /* buckets are cumulative in the exposition format */
+    uint64_t total = 0;
+    for(int i = 0; i < METRICS_BUCKETS; i++) {
+        total += hist->buckets[i].load(std::memory_order_relaxed);
+        if(i < METRICS_BUCKETS - 1) {
+            fprintf(file, "%s_bucket{le=\"%g\"} %llu\n", name, hist->bounds[i], (unsigned long long) total);
+        } else {
+            fprintf(file, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) total);
+        }
+    }
+    fprintf(file, "%s_sum %.9f\n", name, hist->sum_ns.load(std::memory_order_relaxed) / 1e9);
+    fprintf(file, "%s_count %llu\n", name, (unsigned long long) total);
+}
+
+int metrics_write(METRICS *metrics, const char *path) {
+    std::string tmp_path = std::string(path) + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "w");
+    if(file == NULL) {
+        return -1;
+    }
+
+    write_counter(file, "chip8_instructions_total", "Instructions executed.", metrics->instructions);
+    write_counter(file, "chip8_draws_total", "Display instructions (Dxyn, 00E0) executed.", metrics->draws);
+    write_counter(file, "chip8_presents_total", "Frames presented.", metrics->presents);
+    write_counter(file, "chip8_key_events_total", "Key events applied to the keypad.", metrics->key_events);
+    write_counter(file, "chip8_dropped_frames_total", "Frames which started after their deadline.", metrics->dropped_frames);
+    write_histogram(file, "chip8_frame_time_seconds", "Time between two presents.", &metrics->frame_time);
+    write_histogram(file, "chip8_present_latency_seconds", "Time to convert, upload and present a frame.", &metrics->present_latency);
+    write_histogram(file, "chip8_input_to_photon_seconds", "Time from a key event to the first changed frame presented after it.", &metrics->input_to_photon);
+
+    if(fclose(file) != 0) {
+        return -1;
+    }
+    return rename(tmp_path.c_str(), path) == 0 ? 0 : -1;
+}
@@ -0,0 +1,66 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+
+/*
+
+    Runtime health metrics, exported in the Prometheus text format.
+
+    References: 1. https://prometheus.io/docs/instrumenting/exposition_formats/
+
+    The registry is updated from CHIP8::cycle() (through CHIP8::set_metrics) and from the game loop
+    with relaxed atomic increments only, and written out every METRICS_PERIOD seconds
+    to a file (atomically replaced), e.g. for the node_exporter textfile collector.
+
+    Metrics:
+        chip8_instructions_total            counter     instructions executed
+        chip8_draws_total                   counter     Dxyn / 00E0 executed
+        chip8_presents_total                counter     frames presented to the window
+        chip8_key_events_total              counter     key up / down events applied to the keypad
+        chip8_dropped_frames_total          counter     60Hz frames which started late (timing model)
+        chip8_frame_time_seconds            histogram   time between two presents
+        chip8_present_latency_seconds       histogram   time to convert, upload and present a frame
+        chip8_input_to_photon_seconds       histogram   time from a key event to the first changed frame presented after it
+
+*/
+
+#define METRICS_PATH        "chip8.prom"    /* file the metrics are written to          */
+#define METRICS_PERIOD      1               /* seconds between two writes               */
+#define METRICS_BUCKETS     10              /* histogram buckets, the last one is +Inf  */
+
+struct HISTOGRAM
+{
+    const double            *bounds;                    /* upper bounds (seconds), METRICS_BUCKETS - 1 of them  */
+    std::atomic<uint64_t>   buckets[METRICS_BUCKETS];   /* observations per bucket (not cumulative)             */
+    std::atomic<uint64_t>   sum_ns;                     /* sum of observations (nanoseconds)                    */
+};
+
+struct METRICS
+{
+    std::atomic<uint64_t>   instructions;
+    std::atomic<uint64_t>   draws;
+    std::atomic<uint64_t>   presents;
+    std::atomic<uint64_t>   key_events;
+    std::atomic<uint64_t>   dropped_frames;
+    HISTOGRAM               frame_time;
+    HISTOGRAM               present_latency;
+    HISTOGRAM               input_to_photon;
+};
+
+/* zeroes the registry and sets up the histogram buckets */
+void metrics_init(METRICS*);
+
+/* records an observation of NS nanoseconds */
+void metrics_observe(HISTOGRAM*, uint64_t);
+
+/* relaxed increment, for the hot paths */
+inline void metrics_inc(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+/* writes the registry to PATH in Prometheus text format (through a temporary file). Returns 0 on success, -1 on error */
+int metrics_write(METRICS*, const char*);
+
+#endif //METRICS_H
@@ -0,0 +1,127 @@
+/*
+
+    The display post-processing kernel (phosphor persistence, scaling and scanlines).
+
+*/
+
+#include "postfx.h"
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+    Mixes color channels of OFF and ON by WEIGHT (0-256), per channel.
+*/
+static uint32_t mix_color(uint32_t off, uint32_t on, uint32_t weight) {
+    uint32_t out = 0;
+    for(int shift = 0; shift < 32; shift += 8) {
+        uint32_t a = (off >> shift) & 0xFF;
+        uint32_t b = (on  >> shift) & 0xFF;
+        out |= (((a * (256 - weight) + b * weight) >> 8) & 0xFF) << shift;
+    }
+    return out;
+}
+
+void pfx_init(PFX_STATE *pfx, int width, int height, uint32_t on_color, uint32_t off_color, bool phosphor, bool scanlines) {
+    pfx->width  = width;
+    pfx->height = height;
+    memset(pfx->history, 0x0, sizeof(pfx->history));
+
+    for(int i = 0; i < 256; i++) {
+        /* 255 maps to the full ON color */
+        uint32_t weight = (i == 255) ? 256 : i;
+        pfx->palette[i]      = mix_color(off_color, on_color, weight);
+        pfx->scan_palette[i] = mix_color(off_color, on_color, (weight * PFX_SCANLINE) >> 8);
+    }
+
+    pfx->phosphor  = phosphor;
+    pfx->scanlines = scanlines;
+}
+
+/*
+    history = max(pixel ? 255 : 0, history * PFX_DECAY / 256), for every pixel.
+    Returns true if some pixel is OFF but still glowing.
+*/
+static bool blend(uint8_t *history, const uint8_t *pixels, int size, bool phosphor) {
+    int i = 0;
+    bool fading = false;
+
+    if(!phosphor) {
+        for(; i < size; i++) {
+            history[i] = pixels[i] ? 0xFF : 0x0;
+        }
+        return false;
+    }
+
+#ifdef __SSE2__
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i decay = _mm_set1_epi16(PFX_DECAY);
+    __m128i glow = zero;
+
+    for(; i + 16 <= size; i += 16) {
+        __m128i h   = _mm_loadu_si128((const __m128i*) (history + i));
+        __m128i p   = _mm_loadu_si128((const __m128i*) (pixels  + i));
+
+        /* h * decay >> 8, in 16-bit lanes */
+        __m128i lo  = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(h, zero), decay), 8);
+        __m128i hi  = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(h, zero), decay), 8);
+        h = _mm_packus_epi16(lo, hi);
+
+        /* OFF pixels keep the decayed value, ON pixels go to 255 */
+        __m128i off = _mm_cmpeq_epi8(p, zero);
+        glow = _mm_or_si128(glow, _mm_and_si128(off, h));
+        h    = _mm_max_epu8(h, _mm_andnot_si128(off, _mm_set1_epi8((char) 0xFF)));
+
+        _mm_storeu_si128((__m128i*) (history + i), h);
+    }
+    fading = _mm_movemask_epi8(_mm_cmpeq_epi8(glow, zero)) != 0xFFFF;
+#endif
+
+    for(; i < size; i++) {
+        uint8_t h = (history[i] * PFX_DECAY) >> 8;
+        if(pixels[i]) {
+            h = 0xFF;
+        } else if(h) {
+            fading = true;
+        }
+        history[i] = h;
+    }
+    return fading;
+}
+
+bool pfx_apply(PFX_STATE *pfx, const uint8_t *pixels, uint32_t *out, int pitch) {
+    bool fading = blend(pfx->history, pixels, pfx->width * pfx->height, pfx->phosphor);
+    int  scale  = PFX_WIDTH / pfx->width;
+
+    for(int y = 0; y < pfx->height; y++) {
+        const uint8_t *src = pfx->history + y * pfx->width;
+        uint32_t *row = (uint32_t*) ((uint8_t*) out + (y * scale) * pitch);
+
+        /* first row of the block, through the palette */
+        for(int x = 0; x < pfx->width; x++) {
+            uint32_t color = pfx->palette[src[x]];
+            for(int s = 0; s < scale; s++) {
+                row[x * scale + s] = color;
+            }
+        }
+
+        /* the rest of the block are copies */
+        for(int s = 1; s < scale; s++) {
+            memcpy((uint8_t*) row + s * pitch, row, PFX_WIDTH * sizeof(uint32_t));
+        }
+
+        /* last row of the block, darker */
+        if(pfx->scanlines) {
+            uint32_t *scan = (uint32_t*) ((uint8_t*) row + (scale - 1) * pitch);
+            for(int x = 0; x < pfx->width; x++) {
+                uint32_t color = pfx->scan_palette[src[x]];
+                for(int s = 0; s < scale; s++) {
+                    scan[x * scale + s] = color;
+                }
+            }
+        }
+    }
+    return fading;
+}
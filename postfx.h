@@ -0,0 +1,53 @@
+#ifndef POSTFX_H
+#define POSTFX_H
+
+#include <cstdint>
+#include "chip8.h"
+
+/*
+
+    CPU post-processing of the CHIP8 display, run between the DISP conversion and the texture upload.
+
+        Phosphor:  every pixel keeps an intensity (0-255) which is set to 255 while the pixel is ON,
+                   and decays exponentially (x PFX_DECAY / 256 per frame) once it is OFF.
+                   This hides the flicker of sprites being XOR-erased and redrawn.
+
+        Scaling:   every pixel is written as a PFX_SCALE x PFX_SCALE block straight into the
+                   (locked) streaming texture, optionally with the last row of each block darkened
+                   to PFX_SCANLINE / 256 to look like scanlines. The 128 x 64 display of the
+                   SUPER-CHIP / XO-CHIP variants is scaled half as much, to the same output size.
+                   Any bitplane set counts as ON.
+
+    The blend works on 16 pixels at a time (SSE2, with a scalar fallback),
+    the scaling builds one output row per display row and copies it for the rest of the block.
+
+*/
+
+#define PFX_SCALE       4           /* output pixels per display pixel (each direction)     */
+#define PFX_DECAY       0xB0        /* intensity kept per frame, out of 256                 */
+#define PFX_SCANLINE    0x90        /* brightness of a scanline row, out of 256             */
+#define PFX_WIDTH       (MAX_WIDTH  * PFX_SCALE)
+#define PFX_HEIGHT      (MAX_HEIGHT * PFX_SCALE)
+
+struct PFX_STATE
+{
+    int      width;                     /* display size (pixels)                        */
+    int      height;
+    uint8_t  history[HIRES_DISPSIZE];   /* phosphor intensity per pixel                 */
+    uint32_t palette[256];              /* intensity -> ARGB                            */
+    uint32_t scan_palette[256];         /* intensity -> ARGB, for scanline rows         */
+    bool     phosphor;                  /* decay ON                                     */
+    bool     scanlines;                 /* scanlines ON                                 */
+};
+
+/* Sets up a width x height display, the palettes between OFF and ON color (ARGB), and clears the history */
+void pfx_init(PFX_STATE*, int, int, uint32_t, uint32_t, bool, bool);
+
+/*
+    Blends the frame (width x height pixels, PIX_OFF or not) into the history and writes the
+    scaled result to a PFX_WIDTH x PFX_HEIGHT ARGB buffer with the given pitch (bytes).
+    Returns true while some pixel is still fading, i.e. the next frame will differ even if DISP does not.
+*/
+bool pfx_apply(PFX_STATE*, const uint8_t*, uint32_t*, int);
+
+#endif //POSTFX_H
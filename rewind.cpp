@@ -0,0 +1,265 @@
+/*
+
+    Execution history and reverse execution (see rewind.h).
+
+*/
+
+#include "rewind.h"
+
+#define REPLAY_SEEK     0           /* replay: carry on over breakpoints and watchpoints            */
+#define REPLAY_SCAN     1           /* replay: carry on, remembering the last stop before a point   */
+#define REPLAY_STOP     2           /* replay: return at the first stop                             */
+#define REPLAY_NONE     UINT64_MAX  /* no stop found                                                */
+
+REWIND::REWIND() {
+    interval = REWIND_INTERVAL;
+    log_base = 0;
+    end      = 0;
+}
+
+REWIND::~REWIND() {
+    for(size_t f = 0; f < frames.size(); f++) {
+        delete frames[f].snap;
+    }
+}
+
+void REWIND::set_interval(uint64_t instrs) {
+    interval = instrs > 0 ? instrs : 1;
+}
+
+/*
+    Keyframes the current state, then drops the keyframes (and key events) nothing needs any more:
+    the ones before the REWIND_WINDOW, or past REWIND_MAXKEYS.
+*/
+void REWIND::take_frame(CHIP8 *chip8_instance) {
+    REWIND_FRAME frame;
+    frame.snap    = new CHIP8(*chip8_instance);
+    frame.instrs  = chip8_instance->get_instrs();
+    frame.cycles  = chip8_instance->get_cycles();
+    frame.log_pos = log_base + log.size();
+    frames.push_back(frame);
+
+    uint64_t now = frame.cycles;
+    while(frames.size() > 1 && (frames.size() > REWIND_MAXKEYS || frames[1].cycles + REWIND_WINDOW <= now)) {
+        delete frames.front().snap;
+        frames.pop_front();
+    }
+    while(log_base < frames.front().log_pos) {
+        log.pop_front();
+        log_base++;
+    }
+}
+
+/*
+    Returns the index of the newest keyframe at or before instruction INSTR, -1 if none.
+*/
+int REWIND::frame_before(uint64_t instr) {
+    int lo = 0, hi = (int) frames.size() - 1, found = -1;
+    while(lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if(frames[mid].instrs <= instr) {
+            found = mid;
+            lo    = mid + 1;
+        } else {
+            hi    = mid - 1;
+        }
+    }
+    return found;
+}
+
+/*
+    Puts the instance back at keyframe F (keeping its debugger maps and attachments).
+    Returns the log position to replay the key events from.
+*/
+uint64_t REWIND::restore(CHIP8 *chip8_instance, int f) {
+    *chip8_instance = *frames[f].snap;
+    return frames[f].log_pos;
+}
+
+/*
+    Runs the instance up to instruction TARGET, applying the logged key events from *POS at their
+    instruction counts. MODE is REPLAY_SEEK, REPLAY_SCAN (*STOP is set to the last point before
+    BEFORE execution stopped at) or REPLAY_STOP.
+    Returns 0, DBG_STOP (a watchpoint hit by the last instruction, or any stop with REPLAY_STOP), or -1.
+*/
+int REWIND::replay(CHIP8 *chip8_instance, uint64_t *pos, uint64_t target, int mode, uint64_t before, uint64_t *stop) {
+    while(chip8_instance->get_instrs() < target) {
+        uint64_t instrs = chip8_instance->get_instrs();
+        while(*pos < log_base + log.size() && log[*pos - log_base].instr <= instrs) {
+            chip8_instance->set_key(log[*pos - log_base].key, log[*pos - log_base].val);
+            (*pos)++;
+        }
+
+        int status = chip8_instance->cycle();
+        if(status == -1) {
+            return -1;
+        }
+        if(status == DBG_STOP) {
+            uint64_t point = chip8_instance->get_instrs();
+            if(mode == REPLAY_STOP || point >= target) {
+                return DBG_STOP;
+            }
+            if(mode == REPLAY_SCAN && point < before) {
+                *stop = point;
+            }
+            chip8_instance->resume();
+        }
+    }
+    return 0;
+}
+
+void REWIND::clear(CHIP8 *chip8_instance) {
+    for(size_t f = 0; f < frames.size(); f++) {
+        delete frames[f].snap;
+    }
+    frames.clear();
+    log.clear();
+    log_base = 0;
+    end      = chip8_instance->get_instrs();
+    take_frame(chip8_instance);
+}
+
+void REWIND::record(CHIP8 *chip8_instance) {
+    end = chip8_instance->get_instrs();
+    if(frames.empty() || end >= frames.back().instrs + interval) {
+        take_frame(chip8_instance);
+    }
+}
+
+void REWIND::record_key(CHIP8 *chip8_instance, int key, int val) {
+    REWIND_KEY event;
+    event.instr = chip8_instance->get_instrs();
+    event.key   = key;
+    event.val   = val;
+    log.push_back(event);
+}
+
+void REWIND::cut(CHIP8 *chip8_instance) {
+    uint64_t now = chip8_instance->get_instrs();
+    while(!frames.empty() && frames.back().instrs >= now) {
+        delete frames.back().snap;
+        frames.pop_back();
+    }
+    while(!log.empty() && log.back().instr >= now) {
+        log.pop_back();
+    }
+    end = now;
+    take_frame(chip8_instance);
+}
+
+bool REWIND::in_past(CHIP8 *chip8_instance) {
+    return chip8_instance->get_instrs() < end;
+}
+
+int REWIND::seek(CHIP8 *chip8_instance, uint64_t instr) {
+    if(instr > end) {
+        instr = end;
+    }
+    int f = frame_before(instr);
+    if(f == -1) {
+        return -1;
+    }
+    uint64_t pos = restore(chip8_instance, f);
+    return replay(chip8_instance, &pos, instr, REPLAY_SEEK, 0, NULL);
+}
+
+int REWIND::step_back(CHIP8 *chip8_instance) {
+    uint64_t now = chip8_instance->get_instrs();
+    if(now <= oldest()) {
+        return REWIND_BEGIN;
+    }
+    return seek(chip8_instance, now - 1);
+}
+
+/*
+    Replays the segments between keyframes from the newest one back, until one contains
+    a stop before the current point, and moves to the last such stop.
+*/
+int REWIND::continue_back(CHIP8 *chip8_instance) {
+    uint64_t now = chip8_instance->get_instrs();
+    if(now <= oldest()) {
+        return REWIND_BEGIN;
+    }
+
+    for(int f = frame_before(now); f >= 0; f--) {
+        uint64_t limit = (f + 1 < (int) frames.size() && frames[f + 1].instrs < now) ? frames[f + 1].instrs : now;
+        uint64_t stop  = REPLAY_NONE;
+        uint64_t pos   = restore(chip8_instance, f);
+        if(replay(chip8_instance, &pos, limit, REPLAY_SCAN, now, &stop) == -1) {
+            return -1;
+        }
+        if(stop != REPLAY_NONE) {
+            return seek(chip8_instance, stop) == -1 ? -1 : DBG_STOP;
+        }
+    }
+
+    if(seek(chip8_instance, oldest()) == -1) {
+        return -1;
+    }
+    return REWIND_BEGIN;
+}
+
+/*
+    Resumes an instance moved back to where it stopped for REASON (a restore forgets it):
+    steps over a breakpoint at the point, unless a watchpoint stopped it there.
+*/
+void REWIND::resume_at(CHIP8 *chip8_instance, int reason) {
+    if(reason == DBG_WWR || reason == DBG_WRD) {
+        chip8_instance->resume();
+    } else {
+        chip8_instance->step_over();
+    }
+}
+
+/*
+    Forward while back in time: replays to the current point, then on
+    (stepping over a breakpoint at it, see resume_at) to the next instruction or the end of the history.
+*/
+int REWIND::step(CHIP8 *chip8_instance) {
+    uint64_t now    = chip8_instance->get_instrs();
+    int      reason = chip8_instance->get_stop_reason();
+    if(now >= end) {
+        return REWIND_END;
+    }
+    uint64_t pos = restore(chip8_instance, frame_before(now));
+    if(replay(chip8_instance, &pos, now, REPLAY_SEEK, 0, NULL) == -1) {
+        return -1;
+    }
+    resume_at(chip8_instance, reason);
+    return replay(chip8_instance, &pos, now + 1, REPLAY_STOP, 0, NULL);
+}
+
+int REWIND::continue_forward(CHIP8 *chip8_instance) {
+    uint64_t now    = chip8_instance->get_instrs();
+    int      reason = chip8_instance->get_stop_reason();
+    if(now >= end) {
+        return REWIND_END;
+    }
+    uint64_t pos = restore(chip8_instance, frame_before(now));
+    if(replay(chip8_instance, &pos, now, REPLAY_SEEK, 0, NULL) == -1) {
+        return -1;
+    }
+    resume_at(chip8_instance, reason);
+    int status = replay(chip8_instance, &pos, end, REPLAY_STOP, 0, NULL);
+    return status == 0 ? REWIND_END : status;
+}
+
+uint64_t REWIND::oldest() {
+    return frames.empty() ? end : frames.front().instrs;
+}
+
+uint64_t REWIND::newest() {
+    return end;
+}
+
+size_t REWIND::frame_count() {
+    return frames.size();
+}
+
+size_t REWIND::footprint() {
+    size_t bytes = sizeof(REWIND) + log.size() * sizeof(REWIND_KEY);
+    for(size_t f = 0; f < frames.size(); f++) {
+        bytes += sizeof(REWIND_FRAME) + frames[f].snap->footprint();
+    }
+    return bytes;
+}
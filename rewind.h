@@ -0,0 +1,114 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include "chip8.h"
+
+/*
+
+    Execution history of a CHIP8 instance, for reverse execution (reverse-step / reverse-continue).
+
+    The machine is deterministic given its state and the key events it sees (the RNG is part of it),
+    so the history is:
+        keyframes   : CHIP8 copies taken every INTERVAL instructions (copy-on-write, a keyframe only
+                      owns the pages the game wrote since), the oldest dropped past REWIND_SECONDS of
+                      VIP time or REWIND_MAXKEYS keyframes
+        key log     : every key event, with the instruction count it applied at
+
+    Any earlier point (an instruction count) is reached by restoring the nearest keyframe before it
+    and replaying forward with cycle(), feeding the logged keys at their instruction counts.
+    A seek replays at most INTERVAL instructions, so INTERVAL trades memory against seek time.
+
+    Reverse-continue replays the segments between keyframes backwards in time, with the
+    breakpoints and watchpoints armed, and stops at the last point execution would have stopped at
+    (a breakpoint: before the instruction, a watchpoint: after the instruction which hit it).
+
+    While the instance is back in time, forward execution replays the history up to where it was
+    recorded (step / continue_forward); running it live from there drops the history after it (cut).
+
+*/
+
+#define REWIND_INTERVAL     20000       /* default instructions between two keyframes               */
+#define REWIND_SECONDS      600         /* history kept (VIP time)                                  */
+#define REWIND_MAXKEYS      8192        /* keyframes kept at most                                   */
+#define REWIND_WINDOW       ((uint64_t) REWIND_SECONDS * VIP_CLOCK / VIP_CLOCKS_PER_CYCLE) /* history kept (machine cycles) */
+
+#define REWIND_BEGIN        2           /* return value: stopped at the oldest point of the history */
+#define REWIND_END          3           /* return value: stopped at the newest point of the history */
+
+struct REWIND_KEY
+{
+    uint64_t    instr;                  /* instruction count the event applies at   */
+    uint8_t     key;
+    uint8_t     val;
+};
+
+struct REWIND_FRAME
+{
+    CHIP8       *snap;
+    uint64_t    instrs;                 /* snap's instruction count                 */
+    uint64_t    cycles;                 /* snap's machine cycle count               */
+    uint64_t    log_pos;                /* first key event logged after the snap    */
+};
+
+class REWIND {
+    private:
+        uint64_t                    interval;       /* instructions between two keyframes       */
+        std::deque<REWIND_FRAME>    frames;         /* oldest first                             */
+        std::deque<REWIND_KEY>      log;            /* oldest first                             */
+        uint64_t                    log_base;       /* log position of log.front()              */
+        uint64_t                    end;            /* newest instruction count recorded        */
+
+        void        take_frame(CHIP8*);
+        int         frame_before(uint64_t );
+        uint64_t    restore(CHIP8*, int );
+        int         replay(CHIP8*, uint64_t*, uint64_t , int , uint64_t , uint64_t* );
+        void        resume_at(CHIP8*, int );
+
+    public:
+        REWIND();
+        ~REWIND();
+
+        /* instructions between two keyframes, from the next keyframe on */
+        void        set_interval(uint64_t );
+
+        /* starts the history over at the current state (ROM loaded, reset, swapped) */
+        void        clear(CHIP8*);
+
+        /* after the instance ran live: takes a keyframe if one is due, and drops the oldest */
+        void        record(CHIP8*);
+
+        /* logs a key event applied at the current instruction */
+        void        record_key(CHIP8*, int , int );
+
+        /*
+            drops the history after the current point and keyframes it:
+            before running live from back in time, or after the state was changed from outside (debugger)
+        */
+        void        cut(CHIP8*);
+
+        /* true if the instance is back in time (there is recorded history after it) */
+        bool        in_past(CHIP8*);
+
+        /*
+            moves the instance through the history. Return 0, DBG_STOP (at a breakpoint or watchpoint),
+            REWIND_BEGIN / REWIND_END (no history left that way), or -1 on error.
+        */
+        int         seek(CHIP8*, uint64_t );
+        int         step_back(CHIP8*);
+        int         continue_back(CHIP8*);
+        int         step(CHIP8*);
+        int         continue_forward(CHIP8*);
+
+        /* oldest and newest instruction counts which can be reached */
+        uint64_t    oldest();
+        uint64_t    newest();
+
+        /* keyframes held, and bytes used by them and the key log */
+        size_t      frame_count();
+        size_t      footprint();
+};
+
+#endif //REWIND_H
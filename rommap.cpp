@@ -0,0 +1,335 @@
+/*
+
+    Static ROM analysis: code / data split, basic blocks and call graph (see rommap.h).
+
+*/
+
+#include "rommap.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <algorithm>
+
+static uint16_t fetch(const uint8_t *mem, int addr) {
+    return (mem[addr] << 8) | mem[addr + 1];
+}
+
+/* true for the opcodes which end a basic block */
+static bool ends_block(uint16_t op) {
+    switch(op >> 12) {
+        case 0x0: return op == 0x00EE;
+        case 0x1:
+        case 0x2:
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+        case 0xB:
+        case 0xE: return true;
+    }
+    return false;
+}
+
+/* marks ADDR as the start of a block and queues it for the walk */
+static void add_leader(ROM_MAP *map, std::vector<uint16_t>& work, int addr) {
+    if(addr >= 0 && addr < MAX_MEMSIZE) {
+        map->flags[addr] |= MAP_LEADER;
+        work.push_back(addr);
+    }
+}
+
+int rommap_analyze(const uint8_t *rom, int size, ROM_MAP *map) {
+    if(size < 0 || size > MAX_ROMSIZE) {
+        return -1;
+    }
+
+    uint8_t mem[MAX_MEMSIZE];
+    memset(mem, 0x0, sizeof(mem));
+    memcpy(mem + PC_STARTADR, rom, size);
+
+    map->size = size;
+    memset(map->kind, MAP_UNKNOWN, sizeof(map->kind));
+    memset(map->flags, 0x0, sizeof(map->flags));
+    map->blocks.clear();
+    map->calls.clear();
+    map->smc.clear();
+
+    int end = PC_STARTADR + size;
+
+    /* (site, first address, bytes) of the memory I points at when it is read or written */
+    struct ACCESS { uint16_t site; int addr; int len; };
+    std::vector<ACCESS>   reads;
+    std::vector<ACCESS>   writes;
+    std::vector<uint16_t> work;
+
+    /*
+        walk every path from the entry point, I is only known along a path
+        after an Annn (-1 if not known)
+    */
+    add_leader(map, work, PC_STARTADR);
+    while(!work.empty()) {
+        int pc = work.back();
+        int I  = -1;
+        work.pop_back();
+
+        while(pc >= PC_STARTADR && pc + 1 < end && !(map->flags[pc] & MAP_INSTR)) {
+            uint16_t op  = fetch(mem, pc);
+            uint16_t NNN = op & 0x0FFF;
+            uint8_t  X   = (op & 0x0F00) >> 8;
+            if(!CHIP8::instr_valid(op)) {
+                break;
+            }
+            map->flags[pc] |= MAP_INSTR;
+            map->kind[pc] = map->kind[pc + 1] = MAP_CODE;
+
+            switch(op >> 12) {
+                case 0x1:
+                    add_leader(map, work, NNN);
+                    break;
+                case 0x2:
+                    add_leader(map, work, NNN);
+                    add_leader(map, work, pc + 2);
+                    map->flags[NNN] |= MAP_CALLEE;
+                    map->calls.push_back(std::make_pair((uint16_t) pc, NNN));
+                    break;
+                case 0x3:
+                case 0x4:
+                case 0x5:
+                case 0x9:
+                case 0xE:
+                    add_leader(map, work, pc + 2);
+                    add_leader(map, work, pc + 4);
+                    break;
+                case 0xB:
+                    map->flags[pc] |= MAP_COMPUTED;
+                    break;
+                case 0xA:
+                    I = NNN;
+                    break;
+                case 0xD:
+                    if(I >= 0) {
+                        ACCESS read = {(uint16_t) pc, I, op & 0x000F};
+                        reads.push_back(read);
+                    }
+                    break;
+                case 0xF:
+                    switch(op & 0x00FF) {
+                        case 0x33:
+                            if(I >= 0) {
+                                ACCESS write = {(uint16_t) pc, I, 3};
+                                writes.push_back(write);
+                            }
+                            break;
+                        case 0x55:
+                        case 0x65:
+                            if(I >= 0) {
+                                ACCESS access = {(uint16_t) pc, I, X + 1};
+                                ((op & 0x00FF) == 0x55 ? writes : reads).push_back(access);
+                                I += X + 1;
+                            }
+                            break;
+                        case 0x1E:
+                        case 0x29:
+                            I = -1;
+                            break;
+                    }
+                    break;
+            }
+
+            if(ends_block(op)) {
+                break;
+            }
+            pc += 2;
+        }
+    }
+
+    /* data: bytes read through I which are not code */
+    for(size_t r = 0; r < reads.size(); r++) {
+        for(int a = reads[r].addr; a < reads[r].addr + reads[r].len && a < MAX_MEMSIZE; a++) {
+            if(map->kind[a] == MAP_UNKNOWN) {
+                map->kind[a] = MAP_DATA;
+            }
+        }
+    }
+
+    /* self-modifying code: writes which land on code */
+    for(size_t w = 0; w < writes.size(); w++) {
+        for(int a = writes[w].addr; a < writes[w].addr + writes[w].len && a < MAX_MEMSIZE; a++) {
+            if(map->kind[a] == MAP_CODE) {
+                map->flags[writes[w].site] |= MAP_SMC;
+                map->smc.push_back(std::make_pair(writes[w].site, (uint16_t) a));
+                break;
+            }
+        }
+    }
+
+    /* blocks: from every leader which is an instruction, up to the next leader or block end */
+    for(int a = PC_STARTADR; a < end; a++) {
+        if(!(map->flags[a] & MAP_LEADER) || !(map->flags[a] & MAP_INSTR)) {
+            continue;
+        }
+        ROM_BLOCK block;
+        block.start = a;
+
+        int pc = a;
+        while(true) {
+            uint16_t op   = fetch(mem, pc);
+            int      next = pc + 2;
+            if(ends_block(op)) {
+                block.end = next;
+                switch(op >> 12) {
+                    case 0x1: block.succ.push_back(op & 0x0FFF); break;
+                    case 0x2: block.succ.push_back(op & 0x0FFF); block.succ.push_back(next); break;
+                    case 0xB: break;
+                    case 0x0: break;
+                    default:  block.succ.push_back(next); block.succ.push_back(next + 2); break;
+                }
+                break;
+            }
+            if(next >= end || !(map->flags[next] & MAP_INSTR) || (map->flags[next] & MAP_LEADER)) {
+                block.end = next;
+                if(next < end && (map->flags[next] & MAP_INSTR)) {
+                    block.succ.push_back(next);
+                }
+                break;
+            }
+            pc = next;
+        }
+        map->blocks.push_back(block);
+    }
+
+    std::sort(map->calls.begin(), map->calls.end());
+    return 0;
+}
+
+int rommap_analyze_file(const char *path, ROM_MAP *map) {
+    std::ifstream rom_file(path, std::ios::binary);
+    if(!rom_file.is_open()) {
+        return -1;
+    }
+
+    uint8_t rom[MAX_ROMSIZE + 1];
+    rom_file.read((char*) rom, sizeof(rom));
+    int size = rom_file.gcount();
+    if(size > MAX_ROMSIZE) {
+        return -1;
+    }
+    return rommap_analyze(rom, size, map);
+}
+
+/* writes the runs of bytes of KIND as "<name> <start> <end>" records */
+static void write_ranges(FILE *out, const ROM_MAP *map, uint8_t kind, const char *name) {
+    int end = PC_STARTADR + map->size;
+    for(int a = PC_STARTADR; a < end; a++) {
+        if(map->kind[a] != kind) {
+            continue;
+        }
+        int start = a;
+        while(a < end && map->kind[a] == kind) {
+            a++;
+        }
+        fprintf(out, "%s %03x %03x\n", name, start, a);
+    }
+}
+
+int rommap_write(const ROM_MAP *map, const char *path, const char *name) {
+    FILE *out = fopen(path, "w");
+    if(out == NULL) {
+        return -1;
+    }
+
+    fprintf(out, "rom %s %d\n", name, map->size);
+    for(size_t b = 0; b < map->blocks.size(); b++) {
+        fprintf(out, "block %03x %03x", map->blocks[b].start, map->blocks[b].end);
+        for(size_t s = 0; s < map->blocks[b].succ.size(); s++) {
+            fprintf(out, " %03x", map->blocks[b].succ[s]);
+        }
+        fprintf(out, "\n");
+    }
+    for(size_t c = 0; c < map->calls.size(); c++) {
+        fprintf(out, "call %03x %03x\n", map->calls[c].first, map->calls[c].second);
+    }
+    for(int a = 0; a < MAX_MEMSIZE; a++) {
+        if(map->flags[a] & MAP_COMPUTED) {
+            fprintf(out, "computed %03x\n", a);
+        }
+    }
+    for(size_t s = 0; s < map->smc.size(); s++) {
+        fprintf(out, "smc %03x %03x\n", map->smc[s].first, map->smc[s].second);
+    }
+    write_ranges(out, map, MAP_CODE, "code");
+    write_ranges(out, map, MAP_DATA, "data");
+
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+int rommap_read(const char *path, ROM_MAP *map) {
+    std::ifstream in(path);
+    if(!in.is_open()) {
+        return -1;
+    }
+
+    map->size = 0;
+    memset(map->kind, MAP_UNKNOWN, sizeof(map->kind));
+    memset(map->flags, 0x0, sizeof(map->flags));
+    map->blocks.clear();
+    map->calls.clear();
+    map->smc.clear();
+
+    std::string line;
+    while(std::getline(in, line)) {
+        char     record[16];
+        char     rest[256];
+        unsigned a = 0, b = 0;
+        int      used = 0;
+        if(sscanf(line.c_str(), "%15s", record) != 1) {
+            continue;
+        }
+        std::string kind = record;
+
+        if(kind == "rom") {
+            if(sscanf(line.c_str(), "rom %255s %d", rest, &map->size) != 2) {
+                return -1;
+            }
+        } else if(kind == "block") {
+            if(sscanf(line.c_str(), "block %x %x%n", &a, &b, &used) != 2 || a >= MAX_MEMSIZE) {
+                return -1;
+            }
+            ROM_BLOCK block;
+            block.start = a;
+            block.end   = b;
+            const char *succ = line.c_str() + used;
+            int         n    = 0;
+            while(sscanf(succ, " %x%n", &a, &n) == 1) {
+                block.succ.push_back(a);
+                succ += n;
+            }
+            map->flags[block.start] |= MAP_LEADER;
+            map->blocks.push_back(block);
+        } else if(kind == "call") {
+            if(sscanf(line.c_str(), "call %x %x", &a, &b) != 2 || b >= MAX_MEMSIZE) {
+                return -1;
+            }
+            map->flags[b] |= MAP_CALLEE;
+            map->calls.push_back(std::make_pair((uint16_t) a, (uint16_t) b));
+        } else if(kind == "computed") {
+            if(sscanf(line.c_str(), "computed %x", &a) != 1 || a >= MAX_MEMSIZE) {
+                return -1;
+            }
+            map->flags[a] |= MAP_COMPUTED;
+        } else if(kind == "smc") {
+            if(sscanf(line.c_str(), "smc %x %x", &a, &b) != 2 || a >= MAX_MEMSIZE) {
+                return -1;
+            }
+            map->flags[a] |= MAP_SMC;
+            map->smc.push_back(std::make_pair((uint16_t) a, (uint16_t) b));
+        } else if(kind == "code" || kind == "data") {
+            if(sscanf(line.c_str(), "%*s %x %x", &a, &b) != 2 || b > MAX_MEMSIZE) {
+                return -1;
+            }
+            memset(map->kind + a, kind == "code" ? MAP_CODE : MAP_DATA, b - a);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef ROMMAP_H
+#define ROMMAP_H
+
+#include <cstdint>
+#include <vector>
+#include "chip8.h"
+
+/*
+
+    Static analysis of a CHIP8 ROM: which bytes are code and which are data,
+    where the basic blocks start and end, and who calls whom.
+
+    The walk starts at PC_STARTADR and follows:
+        1nnn            : jump, ends the block
+        2nnn            : call, ends the block, the callee and the return address are walked
+        00EE            : return, ends the block
+        skips           : 3xkk 4xkk 5xy0 9xy0 Ex9E ExA1, end the block, both PC + 2 and PC + 4 are walked
+        Bnnn            : computed jump (V0 + nnn), ends the block, its targets are unknown (flagged)
+        anything else   : falls through
+    and stops at opcodes the interpreter does not implement, or outside the ROM.
+
+    I is tracked within a block (Annn sets it, Fx55 / Fx65 advance it, Fx1E / Fx29 lose it), so:
+        Dxyn / Fx65     : mark the bytes read from I as data (unless they are code)
+        Fx55 / Fx33     : memory writes, flagged as self-modifying if they land on code
+
+    The map can be exported as text (rommap_write) and loaded back (rommap_read),
+    so the engines and the profiler can use the block boundaries without discovering them.
+
+    Format (addresses in hex, one record per line):
+        rom <name> <size>
+        block <start> <end> [<successor> ...]       end is exclusive
+        call <site> <target>
+        computed <site>
+        smc <site> <address>
+        code <start> <end> / data <start> <end>     byte ranges, end exclusive
+
+*/
+
+#define MAP_UNKNOWN     0           /* byte never reached as code nor referenced as data    */
+#define MAP_CODE        1           /* byte of an instruction                               */
+#define MAP_DATA        2           /* byte read through I (sprites, tables)                */
+
+#define MAP_INSTR       0x01        /* flags: an instruction starts here                    */
+#define MAP_LEADER      0x02        /* flags: a basic block starts here                     */
+#define MAP_CALLEE      0x04        /* flags: a subroutine starts here                      */
+#define MAP_COMPUTED    0x08        /* flags: Bnnn computed jump                            */
+#define MAP_SMC         0x10        /* flags: writes to code (self-modifying)               */
+
+struct ROM_BLOCK
+{
+    uint16_t                start;          /* first instruction                        */
+    uint16_t                end;            /* address after the last instruction       */
+    std::vector<uint16_t>   succ;           /* statically known successors              */
+};
+
+struct ROM_MAP
+{
+    int                     size;                   /* ROM bytes (from PC_STARTADR)     */
+    uint8_t                 kind[MAX_MEMSIZE];      /* MAP_UNKNOWN / MAP_CODE / MAP_DATA */
+    uint8_t                 flags[MAX_MEMSIZE];     /* MAP_INSTR | MAP_LEADER | ...     */
+    std::vector<ROM_BLOCK>  blocks;                 /* in address order                 */
+    std::vector<std::pair<uint16_t, uint16_t> > calls;  /* call site, callee            */
+    std::vector<std::pair<uint16_t, uint16_t> > smc;    /* write site, code address     */
+};
+
+/* Analyzes the SIZE bytes of ROM (loaded at PC_STARTADR) into MAP. Returns 0 on success, -1 if the ROM is too large */
+int  rommap_analyze(const uint8_t*, int, ROM_MAP*);
+
+/* Reads the ROM file at PATH and analyzes it. Returns 0 on success, -1 on error */
+int  rommap_analyze_file(const char*, ROM_MAP*);
+
+/* Writes MAP as text to PATH, NAME is recorded as the ROM name. Returns 0 on success, -1 on error */
+int  rommap_write(const ROM_MAP*, const char*, const char*);
+
+/* Loads the blocks, calls and flags of a map written by rommap_write. Returns 0 on success, -1 on error */
+int  rommap_read(const char*, ROM_MAP*);
+
+#endif //ROMMAP_H
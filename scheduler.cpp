@@ -0,0 +1,320 @@
+/*
+
+    M:N scheduler of interactive CHIP8 sessions (see scheduler.h).
+
+*/
+
+#include <chrono>
+#include <algorithm>
+#include "scheduler.h"
+
+uint64_t sched_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+    The run loop of a session: one pass per frame boundary.
+    Runs the due frames, or suspends on a key wait / while paused, until the session is closed.
+*/
+SESSION_TASK session_loop(SCHEDULER *sched, SESSION *session) {
+    CHIP8 *machine = session->machine;
+
+    while(true) {
+        co_await SCHED_WAIT{sched, session, SESSION_FRAME, session->due};
+
+        int status = sched->take_posts(session);
+        if(status == SESSION_DONE) {
+            break;
+        }
+        if(status == SESSION_PAUSED) {
+            co_await SCHED_WAIT{sched, session, SESSION_PAUSED, SCHED_NEVER};
+            session->due = sched_now();
+            continue;
+        }
+
+        /*
+            on Fx0A nothing happens until a key goes down, but the timers still run out:
+            wakes up for a key event, or at the next timer event (CHIP8::next_timer_event,
+            e.g. the sound going off), the frame it falls in.
+            The frames from the one due on are let pass as polls, up to the one running now.
+        */
+        if(machine->key_waiting()) {
+            uint64_t event  = machine->next_timer_event();
+            uint64_t expiry = event != TIMER_NEVER ?
+                              session->due + (event - machine->get_cycles() - 1) / VIP_CYCLES_PER_FRAME * SCHED_FRAME_NS :
+                              SCHED_NEVER;
+            co_await SCHED_WAIT{sched, session, SESSION_KEY, expiry};
+
+            uint64_t now    = sched_now();
+            uint64_t passed = now >= session->due ? (now - session->due) / SCHED_FRAME_NS + 1 : 0;
+            machine->wait_frames(passed);
+            session->due += passed * SCHED_FRAME_NS;
+            sched->waited += passed;
+            if(session->on_frame && passed > 0) {
+                session->on_frame(session, session->user);
+            }
+            continue;
+        }
+
+        /* the due frame, and the ones after it which are due by now (up to SCHED_MAXLAG) */
+        int ran = 0;
+        do {
+            if(machine->run_frame() == -1) {
+                /* the machine can not go on: held paused (resuming retries) */
+                sched->pause(session, true);
+                break;
+            }
+            ran++;
+            session->due += SCHED_FRAME_NS;
+        } while(ran < SCHED_MAXLAG && sched_now() >= session->due);
+
+        uint64_t now = sched_now();
+        if(now >= session->due) {
+            uint64_t late = (now - session->due) / SCHED_FRAME_NS + 1;
+            session->due += late * SCHED_FRAME_NS;
+            sched->dropped += late;
+        }
+        sched->frames += ran;
+        if(session->on_frame && ran > 0) {
+            session->on_frame(session, session->user);
+        }
+    }
+
+    co_await SCHED_WAIT{sched, session, SESSION_DONE, SCHED_NEVER};
+}
+
+bool SCHED_WAIT::await_suspend(std::coroutine_handle<> handle) {
+    return sched->suspend(session, handle, state, due);
+}
+
+SCHEDULER::SCHEDULER(int threads) {
+    stopping = false;
+    frames   = 0;
+    waited   = 0;
+    dropped  = 0;
+    resumes  = 0;
+    for(int t = 0; t < std::max(threads, 1); t++) {
+        workers.push_back(std::thread(&SCHEDULER::worker, this));
+    }
+}
+
+SCHEDULER::~SCHEDULER() {
+    std::unique_lock<std::mutex> guard(lock);
+    for(size_t i = 0; i < sessions.size(); i++) {
+        sessions[i]->quit = true;
+        if(sessions[i]->state >= SESSION_FRAME) {
+            make_ready(sessions[i]);
+        }
+    }
+    while(!sessions.empty()) {
+        wake.wait(guard);
+    }
+    stopping = true;
+    wake.notify_all();
+    guard.unlock();
+
+    for(size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    /* sessions done while a stale deadline still pointed to them */
+    while(!deadlines.empty()) {
+        SESSION *session = deadlines.top().session;
+        deadlines.pop();
+        if(--session->armed == 0) {
+            delete session->machine;
+            delete session;
+        }
+    }
+}
+
+/*
+    Resumes ready sessions; when there is none, sleeps until the next deadline or a wake-up.
+*/
+void SCHEDULER::worker() {
+    std::unique_lock<std::mutex> guard(lock);
+    while(true) {
+        expire(sched_now());
+        if(!ready.empty()) {
+            SESSION *session = ready.front();
+            ready.pop_front();
+            session->state = SESSION_RUNNING;
+            std::coroutine_handle<> handle = session->handle;
+            guard.unlock();
+
+            /* the session may be resumed elsewhere (or gone) as soon as it suspends, so it is not used after */
+            resumes++;
+            handle.resume();
+            guard.lock();
+            continue;
+        }
+        if(stopping) {
+            break;
+        }
+        if(deadlines.empty()) {
+            wake.wait(guard);
+        } else {
+            wake.wait_until(guard, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadlines.top().due)));
+        }
+    }
+}
+
+/* under the lock */
+void SCHEDULER::make_ready(SESSION *session) {
+    session->state = SESSION_READY;
+    session->gen++;
+    ready.push_back(session);
+    wake.notify_one();
+}
+
+/*
+    Makes ready the sessions whose deadline is NOW or before, skipping stale deadlines
+    (the session was woken since). Under the lock.
+*/
+void SCHEDULER::expire(uint64_t now) {
+    while(!deadlines.empty() && deadlines.top().due <= now) {
+        SCHED_TIMER deadline = deadlines.top();
+        deadlines.pop();
+
+        SESSION *session = deadline.session;
+        session->armed--;
+        if(session->state == SESSION_DONE) {
+            if(session->armed == 0) {
+                delete session->machine;
+                delete session;
+            }
+            continue;
+        }
+        if(deadline.gen == session->gen && (session->state == SESSION_FRAME || session->state == SESSION_KEY)) {
+            make_ready(session);
+        }
+    }
+}
+
+/*
+    Drops a session whose run loop is over (deleted now, or by expire() once no deadline points to it).
+    Under the lock.
+*/
+void SCHEDULER::finish(SESSION *session) {
+    session->state = SESSION_DONE;
+    sessions.erase(std::find(sessions.begin(), sessions.end(), session));
+    if(session->armed == 0) {
+        delete session->machine;
+        delete session;
+    }
+    if(sessions.empty()) {
+        wake.notify_all();
+    }
+}
+
+/*
+    Suspends SESSION (its coroutine is HANDLE) in STATE, with a deadline at DUE unless SCHED_NEVER.
+    Returns false to carry on at once: the session was closed, or what it waits for is already there.
+    SESSION_DONE destroys the coroutine.
+*/
+bool SCHEDULER::suspend(SESSION *session, std::coroutine_handle<> handle, int state, uint64_t due) {
+    std::unique_lock<std::mutex> guard(lock);
+    if(state == SESSION_DONE) {
+        finish(session);
+        guard.unlock();
+        handle.destroy();
+        return true;
+    }
+    if(session->quit || (state == SESSION_KEY && !session->inbox.empty()) || (state == SESSION_PAUSED && !session->paused)) {
+        return false;
+    }
+
+    session->handle = handle;
+    session->state  = state;
+    if(state == SESSION_FRAME && due <= sched_now()) {
+        /* already due: to the back of the queue, so late sessions take turns */
+        make_ready(session);
+    } else if(due != SCHED_NEVER) {
+        bool first = deadlines.empty() || due < deadlines.top().due;
+        deadlines.push({due, session->gen, session});
+        session->armed++;
+        if(first) {
+            wake.notify_one();
+        }
+    }
+    return true;
+}
+
+/*
+    Applies the key events posted to SESSION since the last call.
+    Returns SESSION_DONE if it was closed, SESSION_PAUSED if it is paused, SESSION_RUNNING otherwise.
+*/
+int SCHEDULER::take_posts(SESSION *session) {
+    std::deque<SESSION_KEYEV> keys;
+    int status;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        keys.swap(session->inbox);
+        status = session->quit ? SESSION_DONE : session->paused ? SESSION_PAUSED : SESSION_RUNNING;
+    }
+    for(size_t k = 0; k < keys.size(); k++) {
+        session->machine->set_key(keys[k].key, keys[k].val);
+    }
+    return status;
+}
+
+SESSION* SCHEDULER::open(CHIP8 *machine, SESSION_FN on_frame, void *user) {
+    machine->set_timing(true);
+    machine->set_fusion(FUSE_DEFAULT);
+
+    SESSION *session  = new SESSION();
+    session->machine  = machine;
+    session->on_frame = on_frame;
+    session->user     = user;
+    session->due      = sched_now() + SCHED_FRAME_NS;
+    session->gen      = 0;
+    session->armed    = 0;
+    session->paused   = false;
+    session->quit     = false;
+    session->handle   = session_loop(this, session).handle;
+
+    std::lock_guard<std::mutex> guard(lock);
+    sessions.push_back(session);
+    make_ready(session);
+    return session;
+}
+
+void SCHEDULER::close(SESSION *session) {
+    std::lock_guard<std::mutex> guard(lock);
+    session->quit = true;
+    if(session->state >= SESSION_FRAME) {
+        make_ready(session);
+    }
+}
+
+void SCHEDULER::post_key(SESSION *session, int key, int val) {
+    std::lock_guard<std::mutex> guard(lock);
+    session->inbox.push_back({(uint8_t) (key & (MAX_KEYCOUNT - 1)), (uint8_t) val});
+    if(session->state == SESSION_KEY) {
+        make_ready(session);
+    }
+}
+
+void SCHEDULER::pause(SESSION *session, bool on) {
+    std::lock_guard<std::mutex> guard(lock);
+    session->paused = on;
+    if(!on && session->state == SESSION_PAUSED) {
+        make_ready(session);
+    }
+}
+
+void SCHEDULER::get_stats(SCHED_STATS *stats) {
+    std::lock_guard<std::mutex> guard(lock);
+    stats->sessions = sessions.size();
+    stats->ready    = ready.size();
+    stats->waiting  = 0;
+    stats->paused   = 0;
+    for(size_t i = 0; i < sessions.size(); i++) {
+        stats->waiting += sessions[i]->state == SESSION_KEY;
+        stats->paused  += sessions[i]->state == SESSION_PAUSED;
+    }
+    stats->frames   = frames;
+    stats->waited   = waited;
+    stats->dropped  = dropped;
+    stats->resumes  = resumes;
+}
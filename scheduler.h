@@ -0,0 +1,184 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <coroutine>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <queue>
+#include "chip8.h"
+
+/*
+
+    M:N scheduler of interactive CHIP8 sessions: many more instances than threads (C++20).
+
+    Each session's run loop is a coroutine (session_loop) which suspends
+        at a frame boundary : until its next frame is due (VIP_FRAME_RATE of host time)
+        on a key wait       : the game sits on Fx0A, until a key event is posted for it,
+                              or its delay / sound timer runs out
+        while paused        : until it is resumed
+    and a pool of worker threads resumes the sessions which have work, off one ready queue.
+    Due frames and timer expiries are deadlines in a heap the idle workers sleep on.
+    A session waiting on a key or paused is in neither, so idle sessions cost nothing.
+
+    The frames a session spent on a key wait pass in one step when it wakes (CHIP8::wait_frames),
+    so the machine sees the same time as if it had polled through them. A session late by more than
+    SCHED_MAXLAG frames (the host is overloaded) drops the rest, instead of running them all at once.
+    A session is resumed by one worker at a time, but may move to another between two suspensions.
+
+    Sessions run with the timing model and the default idle loops skipped.
+
+*/
+
+#define SCHED_THREADS       4           /* default worker threads                                   */
+#define SCHED_FRAME_NS      (1000000000ULL / VIP_FRAME_RATE)    /* host time of a frame             */
+#define SCHED_MAXLAG        4           /* frames a late session runs back to back at most          */
+#define SCHED_NEVER         UINT64_MAX  /* no deadline                                              */
+
+/* SESSION states */
+#define SESSION_READY       0           /* in the ready queue                                       */
+#define SESSION_RUNNING     1           /* resumed on a worker                                      */
+#define SESSION_FRAME       2           /* suspended at a frame boundary, until the frame is due    */
+#define SESSION_KEY         3           /* suspended on Fx0A, until a key event or a timer expiry   */
+#define SESSION_PAUSED      4           /* suspended until resumed                                  */
+#define SESSION_DONE        5           /* run loop over                                            */
+
+class SCHEDULER;
+struct SESSION;
+
+/* called by the session after the frames it ran or waited through (on a worker thread) */
+typedef void (*SESSION_FN)(SESSION*, void*);
+
+struct SESSION_KEYEV
+{
+    uint8_t     key;
+    uint8_t     val;
+};
+
+struct SESSION
+{
+    CHIP8                       *machine;       /* owned by the session                         */
+    SESSION_FN                  on_frame;       /* NULL if none                                 */
+    void                        *user;          /* passed to on_frame                           */
+    uint64_t                    due;            /* host time (ns) the next frame starts at      */
+
+    /* under the scheduler lock */
+    int                         state;          /* SESSION_*                                    */
+    uint64_t                    gen;            /* bumped on every wake, older deadlines are stale */
+    int                         armed;          /* deadlines in the heap for this session       */
+    bool                        paused;
+    bool                        quit;
+    std::deque<SESSION_KEYEV>   inbox;          /* key events posted since the last frame       */
+    std::coroutine_handle<>     handle;
+};
+
+/* the coroutine type of session_loop: started and destroyed by the scheduler */
+struct SESSION_TASK
+{
+    struct promise_type
+    {
+        SESSION_TASK        get_return_object() { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void                return_void() {}
+        void                unhandled_exception() { std::terminate(); }
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+/* the run loop of a session, on SCHEDULER's workers */
+SESSION_TASK session_loop(SCHEDULER*, SESSION*);
+
+/* co_await-ed by session_loop: suspends the session in STATE until DUE (SCHED_NEVER: woken by a post) */
+struct SCHED_WAIT
+{
+    SCHEDULER   *sched;
+    SESSION     *session;
+    int         state;
+    uint64_t    due;
+
+    bool        await_ready() { return false; }
+    bool        await_suspend(std::coroutine_handle<> );
+    void        await_resume() {}
+};
+
+struct SCHED_TIMER
+{
+    uint64_t    due;
+    uint64_t    gen;                    /* session gen when armed                   */
+    SESSION     *session;
+
+    bool operator>(const SCHED_TIMER& other) const { return due > other.due; }
+};
+
+struct SCHED_STATS
+{
+    size_t      sessions;               /* open                                     */
+    size_t      ready;                  /* in the ready queue                       */
+    size_t      waiting;                /* on a key wait                            */
+    size_t      paused;
+    uint64_t    frames;                 /* frames run                               */
+    uint64_t    waited;                 /* frames passed on key waits, in one step  */
+    uint64_t    dropped;                /* frames dropped by late sessions          */
+    uint64_t    resumes;                /* coroutine resumes                        */
+};
+
+class SCHEDULER {
+    private:
+        std::mutex                  lock;
+        std::condition_variable     wake;
+        std::deque<SESSION*>        ready;
+        std::priority_queue<SCHED_TIMER, std::vector<SCHED_TIMER>, std::greater<SCHED_TIMER> > deadlines;
+        std::vector<SESSION*>       sessions;       /* open, not DONE                           */
+        std::vector<std::thread>    workers;
+        bool                        stopping;
+
+        std::atomic<uint64_t>       frames;
+        std::atomic<uint64_t>       waited;
+        std::atomic<uint64_t>       dropped;
+        std::atomic<uint64_t>       resumes;
+
+        void        worker();
+        void        make_ready(SESSION*);
+        void        expire(uint64_t );
+        void        finish(SESSION*);
+        bool        suspend(SESSION*, std::coroutine_handle<> , int , uint64_t );
+        int         take_posts(SESSION*);
+
+        friend struct SCHED_WAIT;
+        friend SESSION_TASK session_loop(SCHEDULER*, SESSION*);
+
+    public:
+        /* starts THREADS workers */
+        SCHEDULER(int );
+
+        /* closes every session and joins the workers */
+        ~SCHEDULER();
+
+        /*
+            starts a session running MACHINE (taken over, deleted when the session is closed) from now on.
+            ON_FRAME (may be NULL) is called with USER after the frames it runs.
+        */
+        SESSION*    open(CHIP8*, SESSION_FN , void* );
+
+        /* ends a session: it is gone once its run loop sees it, so SESSION is not used after this */
+        void        close(SESSION*);
+
+        /* key event for a session (any thread), seen at its next frame boundary */
+        void        post_key(SESSION*, int , int );
+
+        /* pauses a session at its next frame boundary, or resumes it */
+        void        pause(SESSION*, bool );
+
+        void        get_stats(SCHED_STATS*);
+};
+
+/* host time (ns), the clock deadlines are on */
+uint64_t sched_now();
+
+#endif //SCHEDULER_H